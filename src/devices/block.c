@@ -3,7 +3,44 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** Ticks a queued read or write may wait before it is dispatched
+   ahead of the elevator's sweep order.  Reads usually have a
+   thread waiting on them, so they get the shorter deadline. */
+#define READ_DEADLINE (TIMER_FREQ / 10)
+#define WRITE_DEADLINE (TIMER_FREQ)
+
+/** Pages in each queue's merge buffer.  Adjacent requests whose
+   buffers are not adjacent in memory are merged through it, up
+   to this many pages' worth of sectors. */
+#define MERGE_PAGES 4
+#define MERGE_SECTORS (MERGE_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/** A request queue, with the thread that dispatches its requests
+   to the device in C-LOOK elevator order: ascending by sector
+   from the position of the last request, wrapping around to the
+   lowest sector at the end.  A request whose deadline has passed
+   goes first regardless.
+
+   Neither rule lets a request pass one queued before it whose
+   sectors overlap its own, unless both are reads, so a read
+   always sees the data of every write submitted before it, and
+   overlapping writes land in submission order. */
+struct block_queue
+  {
+    struct lock lock;                   /**< Protects the members below. */
+    struct condition nonempty;          /**< Signaled on submission. */
+    struct list by_sector;              /**< Pending, ordered by sector. */
+    struct list by_arrival;             /**< Pending, oldest first. */
+    block_sector_t head;                /**< Sector after the last request. */
+    uint8_t *merge_buf;                 /**< MERGE_PAGES pages. */
+  };
 
 /** A block device. */
 struct block
@@ -19,6 +56,11 @@ struct block
 
     unsigned long long read_cnt;        /**< Number of sectors read. */
     unsigned long long write_cnt;       /**< Number of sectors written. */
+
+    struct block_queue *queue;          /**< Request queue, or null. */
+
+    struct block_stats stats;           /**< Latency and queue statistics. */
+    block_sector_t next_sector;         /**< Sector after last request. */
   };
 
 /** List of all block devices. */
@@ -28,6 +70,10 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, bool write, block_sector_t,
+                      size_t cnt, void *buffer);
+static void account_submit (struct block *, struct block_request *);
+static thread_func dispatcher;
 
 /** Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +166,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /** Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +177,159 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/** Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Drivers that can move several sectors with one command do so;
+   for others this is the same as CNT calls to block_read(). */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_request request;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&request, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &request);
+  block_wait (&request);
+}
+
+/** Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  Drivers that can move several sectors with one
+   command do so; for others this is the same as CNT calls to
+   block_write(). */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_request request;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&request, true, sector, cnt, (void *) buffer,
+                      NULL, NULL);
+  block_submit (block, &request);
+  block_wait (&request);
+}
+
+/** Initializes REQUEST to read (or, if WRITE is true, write) the
+   CNT sectors starting at SECTOR into (or from) BUFFER.
+   When the request completes, CALLBACK is called with REQUEST
+   and AUX, or if CALLBACK is null, block_wait() on REQUEST
+   returns. */
+void
+block_request_init (struct block_request *request, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_callback_func *callback, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  request->write = write;
+  request->sector = sector;
+  request->cnt = cnt;
+  request->buffer = buffer;
+  request->deadline = 0;
+  request->block = NULL;
+  request->start = 0;
+  request->callback = callback;
+  request->aux = aux;
+  sema_init (&request->done, 0);
+}
+
+/** Orders block requests by sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a
+    = list_entry (a_, struct block_request, sort_elem);
+  const struct block_request *b
+    = list_entry (b_, struct block_request, sort_elem);
+  return a->sector < b->sector;
+}
+
+/** Submits REQUEST to BLOCK and returns, usually before the
+   request has completed.  If BLOCK has a request queue, the
+   request waits there for BLOCK's dispatcher thread.  Otherwise
+   it is passed on by the driver's submit operation, or failing
+   that carried out before returning.
+   For a device with a submit operation, REQUEST's sector is
+   translated into the other device's numbering. */
+void
+block_submit (struct block *block, struct block_request *request)
+{
+  struct block_queue *q = block->queue;
+
+  check_sector (block, request->sector + request->cnt - 1);
+  if (request->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += request->cnt;
+    }
+  else
+    block->read_cnt += request->cnt;
+  account_submit (block, request);
+
+  if (q != NULL && !intr_context ())
+    {
+      request->deadline = timer_ticks ()
+                          + (request->write ? WRITE_DEADLINE : READ_DEADLINE);
+      lock_acquire (&q->lock);
+      list_insert_ordered (&q->by_sector, &request->sort_elem,
+                           request_less, NULL);
+      list_push_back (&q->by_arrival, &request->fifo_elem);
+      cond_signal (&q->nonempty, &q->lock);
+      lock_release (&q->lock);
+    }
+  else if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, request);
+  else
+    {
+      transfer (block, request->write, request->sector, request->cnt,
+                request->buffer);
+      block_complete (request);
+    }
+}
+
+/** Waits for REQUEST, which must have been submitted without a
+   callback, to complete. */
+void
+block_wait (struct block_request *request)
+{
+  ASSERT (request->callback == NULL);
+  sema_down (&request->done);
+}
+
+/** Gives BLOCK a request queue and a dispatcher thread that feeds
+   it to the driver in elevator order.  Worthwhile for devices
+   where seeks are costly; other devices just run each request
+   as it is submitted. */
+void
+block_enable_queue (struct block *block)
+{
+  struct block_queue *q;
+  char name[sizeof block->name + 8];
+
+  ASSERT (block->queue == NULL);
+
+  q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("Failed to allocate memory for block request queue");
+  lock_init (&q->lock);
+  cond_init (&q->nonempty);
+  list_init (&q->by_sector);
+  list_init (&q->by_arrival);
+  q->head = 0;
+  q->merge_buf = palloc_get_multiple (PAL_ASSERT, MERGE_PAGES);
+
+  snprintf (name, sizeof name, "%s-queue", block->name);
+  block->queue = q;
+  thread_create (name, PRI_DEFAULT, dispatcher, block);
 }
 
 /** Returns the number of sectors in BLOCK. */
@@ -160,21 +353,50 @@ block_type (struct block *block)
   return block->type;
 }
 
-/** Prints statistics for each block device used for a Pintos role. */
+/** Stores a snapshot of BLOCK's statistics in *STATS. */
 void
-block_print_stats (void)
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/** Prints the nonempty buckets of latency histogram HIST, for
+   requests in direction NAME. */
+static void
+print_latency (const char *name, const unsigned long long *hist)
 {
   int i;
 
-  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf ("  %s: %llu in 2**%d cycles%s\n", name, hist[i], i,
+              i == BLOCK_LATENCY_BUCKETS - 1 ? " or more" : "");
+}
+
+/** Prints statistics for each block device that has been used:
+   sector counts, request patterns and latency histograms. */
+void
+block_print_stats (void)
+{
+  struct block *block;
+
+  for (block = block_first (); block != NULL; block = block_next (block))
     {
-      struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct block_stats stats;
+
+      if (block->read_cnt == 0 && block->write_cnt == 0)
+        continue;
+      block_get_stats (block, &stats);
+      printf ("%s (%s): %llu reads, %llu writes\n",
+              block->name, block_type_name (block->type),
+              block->read_cnt, block->write_cnt);
+      printf ("  %llu sequential, %llu random requests, "
+              "%u outstanding at most\n",
+              stats.sequential, stats.random, stats.max_in_flight);
+      print_latency ("read", stats.latency[0]);
+      print_latency ("write", stats.latency[1]);
     }
 }
 
@@ -200,6 +422,9 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->queue = NULL;
+  memset (&block->stats, 0, sizeof block->stats);
+  block->next_sector = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +436,275 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/** Carries out a transfer of CNT sectors starting at SECTOR
+   between BLOCK and BUFFER, using the driver's multi-sector
+   operation when it has one. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          size_t cnt, void *buffer)
+{
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write)
+    {
+      if (cnt > 1 && block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             p + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (cnt > 1 && block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            p + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/** Records the submission of REQUEST to BLOCK in BLOCK's
+   statistics. */
+static void
+account_submit (struct block *block, struct block_request *request)
+{
+  struct block_stats *stats = &block->stats;
+  enum intr_level old_level = intr_disable ();
+
+  if (request->sector == block->next_sector)
+    stats->sequential++;
+  else
+    stats->random++;
+  block->next_sector = request->sector + request->cnt;
+
+  /* A request passed on by another device, as a partition does,
+     is now outstanding here instead of there.  Its latency still
+     counts from when it was first submitted. */
+  if (request->block != NULL)
+    request->block->stats.in_flight--;
+  else
+    request->start = timer_cycles ();
+  request->block = block;
+  if (++stats->in_flight > stats->max_in_flight)
+    stats->max_in_flight = stats->in_flight;
+  intr_set_level (old_level);
+}
+
+/** Reports that REQUEST has completed.  For use by the block
+   layer and by drivers' submit operations. */
+void
+block_complete (struct block_request *request)
+{
+  struct block *block = request->block;
+
+  if (block != NULL)
+    {
+      uint64_t cycles = timer_cycles () - request->start;
+      enum intr_level old_level;
+      int bucket = 0;
+
+      while (cycles > 1 && bucket < BLOCK_LATENCY_BUCKETS - 1)
+        {
+          cycles >>= 1;
+          bucket++;
+        }
+      old_level = intr_disable ();
+      block->stats.latency[request->write][bucket]++;
+      block->stats.in_flight--;
+      intr_set_level (old_level);
+    }
+
+  if (request->callback != NULL)
+    request->callback (request, request->aux);
+  else
+    sema_up (&request->done);
+}
+
+/** Returns the oldest request queued in Q before R whose sectors
+   overlap R's, where at least one of the two is a write, or a
+   null pointer if there is none.  R must be queued in Q, and Q's
+   lock must be held. */
+static struct block_request *
+earlier_conflict (struct block_queue *q, struct block_request *r)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&q->by_arrival); e != &r->fifo_elem;
+       e = list_next (e))
+    {
+      struct block_request *prev
+        = list_entry (e, struct block_request, fifo_elem);
+      if ((prev->write || r->write)
+          && prev->sector < r->sector + r->cnt
+          && r->sector < prev->sector + prev->cnt)
+        return prev;
+    }
+  return NULL;
+}
+
+/** Removes and returns the request that queue Q should dispatch
+   next.  Q must not be empty, and its lock must be held. */
+static struct block_request *
+pick_request (struct block_queue *q)
+{
+  struct block_request *prev;
+  struct block_request *oldest
+    = list_entry (list_front (&q->by_arrival), struct block_request,
+                  fifo_elem);
+  struct block_request *r = NULL;
+  struct list_elem *e;
+
+  if (timer_ticks () >= oldest->deadline)
+    r = oldest;
+  else
+    {
+      /* C-LOOK: the first request at or after the head position,
+         or the lowest one if there is none. */
+      for (e = list_begin (&q->by_sector); e != list_end (&q->by_sector);
+           e = list_next (e))
+        {
+          struct block_request *cand
+            = list_entry (e, struct block_request, sort_elem);
+          if (cand->sector >= q->head)
+            {
+              r = cand;
+              break;
+            }
+        }
+      if (r == NULL)
+        r = list_entry (list_front (&q->by_sector), struct block_request,
+                        sort_elem);
+    }
+
+  /* Go back to the oldest request that R may not pass. */
+  while ((prev = earlier_conflict (q, r)) != NULL)
+    r = prev;
+
+  list_remove (&r->sort_elem);
+  list_remove (&r->fifo_elem);
+  return r;
+}
+
+/** Moves into BATCH, after FIRST, the queued requests that
+   continue FIRST's transfer: same direction, each starting at
+   the sector where the previous one ends, up to MERGE_SECTORS in
+   total, and none passing an earlier request that overlaps it.
+   Returns the total number of sectors.  Q's lock must be held. */
+static size_t
+gather_batch (struct block_queue *q, struct block_request *first,
+              struct list *batch)
+{
+  size_t cnt = first->cnt;
+  struct list_elem *e;
+
+  list_push_back (batch, &first->sort_elem);
+  if (first->cnt >= MERGE_SECTORS)
+    return cnt;
+
+  e = list_begin (&q->by_sector);
+  while (e != list_end (&q->by_sector))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            sort_elem);
+      e = list_next (e);
+      if (r->sector < first->sector + cnt)
+        continue;
+      if (r->sector > first->sector + cnt || r->write != first->write
+          || cnt + r->cnt > MERGE_SECTORS || earlier_conflict (q, r) != NULL)
+        break;
+
+      list_remove (&r->sort_elem);
+      list_remove (&r->fifo_elem);
+      list_push_back (batch, &r->sort_elem);
+      cnt += r->cnt;
+    }
+  return cnt;
+}
+
+/** Carries out the CNT sectors' worth of adjacent requests in
+   BATCH, starting with FIRST, as a single transfer on BLOCK.  If
+   their buffers are adjacent in memory the transfer uses them
+   directly, otherwise it goes through Q's merge buffer. */
+static void
+run_batch (struct block *block, struct block_queue *q,
+           struct block_request *first, struct list *batch, size_t cnt)
+{
+  struct list_elem *e;
+  uint8_t *next = first->buffer;
+  bool contiguous = true;
+  size_t ofs;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            sort_elem);
+      if (r->buffer != next)
+        contiguous = false;
+      next = (uint8_t *) r->buffer + r->cnt * BLOCK_SECTOR_SIZE;
+    }
+
+  if (contiguous)
+    {
+      transfer (block, first->write, first->sector, cnt, first->buffer);
+      return;
+    }
+
+  if (first->write)
+    for (ofs = 0, e = list_begin (batch); e != list_end (batch);
+         e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request,
+                                              sort_elem);
+        memcpy (q->merge_buf + ofs, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+        ofs += r->cnt * BLOCK_SECTOR_SIZE;
+      }
+  transfer (block, first->write, first->sector, cnt, q->merge_buf);
+  if (!first->write)
+    for (ofs = 0, e = list_begin (batch); e != list_end (batch);
+         e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request,
+                                              sort_elem);
+        memcpy (r->buffer, q->merge_buf + ofs, r->cnt * BLOCK_SECTOR_SIZE);
+        ofs += r->cnt * BLOCK_SECTOR_SIZE;
+      }
+}
+
+/** Dispatcher thread for the block device BLOCK_, which has a
+   request queue.  Repeatedly takes the next request in elevator
+   order, merges the queued requests that continue it, hands
+   them to the driver as one transfer, and completes them. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+  struct block_queue *q = block->queue;
+
+  for (;;)
+    {
+      struct block_request *first;
+      struct list batch;
+      size_t cnt;
+
+      list_init (&batch);
+      lock_acquire (&q->lock);
+      while (list_empty (&q->by_arrival))
+        cond_wait (&q->nonempty, &q->lock);
+      first = pick_request (q);
+      cnt = gather_batch (q, first, &batch);
+      q->head = first->sector + cnt;
+      lock_release (&q->lock);
+
+      run_batch (block, q, first, &batch, cnt);
+      while (!list_empty (&batch))
+        block_complete (list_entry (list_pop_front (&batch),
+                              struct block_request, sort_elem));
+    }
+}
+
 /** Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -2,7 +2,10 @@
 #define DEVICES_BLOCK_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /** Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,10 +56,70 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/** Asynchronous requests. */
+
+struct block_request;
+
+/** Called by the block layer, from a kernel thread, when REQUEST
+   has finished.  Must not sleep for long, since it holds up the
+   device's other requests. */
+typedef void block_callback_func (struct block_request *request, void *aux);
+
+/** A request to read or write CNT consecutive sectors.
+   Initialize with block_request_init(), then pass to
+   block_submit().  The request and its buffer must stay valid
+   until it completes. */
+struct block_request
+  {
+    struct list_elem sort_elem;         /**< In queue, by sector. */
+    struct list_elem fifo_elem;         /**< In queue, by arrival. */
+    bool write;                         /**< Write? Otherwise read. */
+    block_sector_t sector;              /**< First sector. */
+    size_t cnt;                         /**< Number of sectors. */
+    void *buffer;                       /**< CNT * BLOCK_SECTOR_SIZE bytes. */
+    int64_t deadline;                   /**< Timer tick to dispatch by. */
+    struct block *block;                /**< Device carrying it out. */
+    uint64_t start;                     /**< timer_cycles() at submission. */
+    block_callback_func *callback;      /**< Completion callback, or null. */
+    void *aux;                          /**< Passed to CALLBACK. */
+    struct semaphore done;              /**< Up'd on completion if no
+                                           CALLBACK. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_callback_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+void block_enable_queue (struct block *);
+void block_complete (struct block_request *);
+
 /** Statistics. */
+
+/** Number of latency histogram buckets.  Bucket I counts requests
+   that took between 2**I and 2**(I+1) CPU cycles from submission
+   to completion; the last bucket also counts longer ones. */
+#define BLOCK_LATENCY_BUCKETS 32
+
+/** Statistics for one block device, beyond its sector counts. */
+struct block_stats
+  {
+    unsigned long long latency[2][BLOCK_LATENCY_BUCKETS];
+                                        /**< [0] reads, [1] writes. */
+    unsigned long long sequential;      /**< Requests continuing the last. */
+    unsigned long long random;          /**< Other requests. */
+    unsigned in_flight;                 /**< Requests outstanding now. */
+    unsigned max_in_flight;             /**< Most ever outstanding. */
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /** Lower-level interface to block device drivers. */
@@ -65,6 +128,21 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer calls read or write once per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Carries out REQUEST, already counted and
+       checked against this device's size, usually by passing it
+       on to other devices, as a partition does for the disk it
+       lives on.  The driver must eventually call
+       block_complete() on REQUEST.  Without this, requests to a
+       device with no queue run synchronously in block_submit(). */
+    void (*submit) (void *aux, struct block_request *request);
   };
 
 struct block *block_register (const char *name, enum block_type,
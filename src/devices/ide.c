@@ -6,9 +6,12 @@
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
+#include "devices/pci.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /** The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +33,41 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /**< Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /**< Alt Status (r/o). */
 
+/** Bus master IDE registers, found through the controller's PCI
+   BAR 4, eight ports per channel.  See [SFF-8038i]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /**< Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /**< Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /**< PRD table. */
+
+/** Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /**< Start transfer. */
+#define BM_CMD_READ 0x08        /**< Transfer from disk into memory. */
+
+/** Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /**< Transfer failed (write 1 to clear). */
+#define BM_STA_IRQ 0x04         /**< Disk interrupted (write 1 to clear). */
+
+/** PCI class and subclass of an IDE controller.  Programming
+   interface bit 7 means it can do bus master DMA. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_IDE_BUS_MASTER 0x80
+
+/** Physical Region Descriptor: one contiguous piece of a DMA
+   transfer's memory buffer. */
+struct prd
+  {
+    uint32_t addr;              /**< Physical address. */
+    uint16_t size;              /**< Size in bytes, 0 means 64 kB. */
+    uint16_t flags;             /**< PRD_EOT in the table's last entry. */
+  };
+#define PRD_EOT 0x8000          /**< End of table. */
+
 /** Alternate Status Register bits. */
 #define STA_BSY 0x80            /**< Busy. */
 #define STA_DRDY 0x40           /**< Device Ready. */
 #define STA_DRQ 0x08            /**< Data Request. */
+#define STA_ERR 0x01            /**< Error. */
 
 /** Control Register bits. */
 #define CTL_SRST 0x04           /**< Software Reset. */
@@ -49,6 +83,15 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /**< IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /**< READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /**< WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /**< READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /**< WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /**< SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /**< READ DMA. */
+#define CMD_WRITE_DMA 0xca              /**< WRITE DMA. */
+
+/** Most sectors a single READ or WRITE command can move.  A
+   Sector Count register value of 0 means this many. */
+#define MAX_COMMAND_SECTORS 256
 
 /** An ATA device. */
 struct ata_disk
@@ -57,6 +100,9 @@ struct ata_disk
     struct channel *channel;    /**< Channel that disk is attached to. */
     int dev_no;                 /**< Device 0 or 1 for master or slave. */
     bool is_ata;                /**< Is device an ATA disk? */
+    int multiple_cnt;           /**< Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /**< Transfer by bus master DMA? */
   };
 
 /** An ATA channel (aka controller).
@@ -72,6 +118,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /**< Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /**< Bus master I/O base, 0 if no DMA. */
+    struct prd *prdt;           /**< PRD table, one page. */
+
     struct ata_disk devices[2];     /**< The devices on this channel. */
   };
 
@@ -85,10 +134,22 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, const uint16_t *id);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
+
+static void pio_read (struct ata_disk *, block_sector_t, size_t cnt,
+                      void *);
+static void pio_write (struct ata_disk *, block_sector_t, size_t cnt,
+                       const void *);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *, bool write);
+static void build_prdt (struct channel *, void *, size_t size);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,8 +162,20 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  struct pci_dev controller;
+  uint16_t bm_base = 0;
   size_t chan_no;
 
+  /* Find the bus master registers of a DMA-capable IDE controller,
+     such as the PIIX, if there is one. */
+  if (pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &controller)
+      && (controller.prog_if & PCI_IDE_BUS_MASTER) != 0)
+    {
+      bm_base = pci_get_bar (&controller, 4);
+      if (bm_base != 0)
+        pci_enable_master (&controller);
+    }
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -126,6 +199,14 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +217,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple_cnt = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -265,6 +348,7 @@ identify_ata_device (struct ata_disk *d)
   char *model, *serial;
   char extra_info[128];
   struct block *block;
+  bool dma;
 
   ASSERT (d->is_ata);
 
@@ -281,13 +365,16 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Calculate capacity and check for DMA support (word 49, bit 8)
+     on both the disk and its channel.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -303,12 +390,41 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Let READ/WRITE MULTIPLE move several sectors per interrupt. */
+  set_multiple_mode (d, (const uint16_t *) id);
+  d->dma = dma;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_enable_queue (block);
   partition_scan (block);
 }
 
+/** Enables READ MULTIPLE and WRITE MULTIPLE on disk D, using the
+   largest block size that D's IDENTIFY DEVICE data in ID allows.
+   Leaves D->multiple_cnt at 0 if D does not support them. */
+static void
+set_multiple_mode (struct ata_disk *d, const uint16_t *id)
+{
+  struct channel *c = d->channel;
+  int max = id[47] & 0xff;
+
+  /* SET MULTIPLE MODE only accepts powers of 2. */
+  while (max & (max - 1))
+    max &= max - 1;
+  if (max <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), max);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple_cnt = max;
+}
+
 /** Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -347,12 +463,15 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  if (!dma_transfer (d, sec_no, 1, buffer, false))
+    {
+      select_sector (d, sec_no, 1);
+      issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+      input_sector (c, buffer);
+    }
   lock_release (&c->lock);
 }
 
@@ -367,33 +486,240 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (!dma_transfer (d, sec_no, 1, (void *) buffer, true))
+    {
+      select_sector (d, sec_no, 1);
+      issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      output_sector (c, buffer);
+      sema_down (&c->completion_wait);
+    }
+  lock_release (&c->lock);
+}
+
+/** Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Each command moves up to MAX_COMMAND_SECTORS sectors, by DMA
+   when possible and otherwise by pio_read().
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  uint8_t *p = buffer;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+
+      if (!dma_transfer (d, sec_no, n, p, false))
+        pio_read (d, sec_no, n, p);
+
+      sec_no += n;
+      p += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
+
+/** Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving all of the
+   data.  Batches sectors into commands as ide_read_multiple()
+   does.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *p = buffer;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+
+      if (!dma_transfer (d, sec_no, n, (void *) p, true))
+        pio_write (d, sec_no, n, p);
+
+      sec_no += n;
+      p += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/** Reads CNT sectors, at most MAX_COMMAND_SECTORS, starting at
+   SEC_NO from disk D into BUFFER with a single PIO command.
+   With multiple mode enabled the disk interrupts once per
+   D->multiple_cnt sectors, otherwise once per sector.
+   D's channel lock must be held. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          void *buffer)
+{
+  struct channel *c = d->channel;
+  size_t per_irq = d->multiple_cnt > 0 ? (size_t) d->multiple_cnt : 1;
+  uint8_t *p = buffer;
+  size_t done;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple_cnt > 0
+                        ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += per_irq)
+    {
+      size_t blk = cnt - done < per_irq ? cnt - done : per_irq;
+
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu,
+               d->name, sec_no + done);
+      input_sectors (c, p + done * BLOCK_SECTOR_SIZE, blk);
+    }
+}
+
+/** Writes CNT sectors, at most MAX_COMMAND_SECTORS, starting at
+   SEC_NO to disk D from BUFFER with a single PIO command, and
+   waits for the disk to acknowledge them.
+   D's channel lock must be held. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const void *buffer)
+{
+  struct channel *c = d->channel;
+  size_t per_irq = d->multiple_cnt > 0 ? (size_t) d->multiple_cnt : 1;
+  const uint8_t *p = buffer;
+  size_t done;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple_cnt > 0
+                        ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += per_irq)
+    {
+      size_t blk = cnt - done < per_irq ? cnt - done : per_irq;
+
+      /* The disk asks for the first block without an interrupt
+         and interrupts when it is ready for each later one. */
+      if (done > 0)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, sec_no + done);
+      output_sectors (c, p + done * BLOCK_SECTOR_SIZE, blk);
+    }
+  sema_down (&c->completion_wait);
+}
+
+/** Moves the CNT sectors, at most MAX_COMMAND_SECTORS, starting at
+   SEC_NO between disk D and BUFFER by bus-master DMA: from the
+   disk into BUFFER, or into the disk from BUFFER if WRITE is
+   true.  The controller moves the data itself while the calling
+   thread sleeps, so the CPU is free to run other threads.
+   Returns true if successful.  Returns false without touching
+   the disk if D or BUFFER is not suitable for DMA, or after a
+   failed transfer, which also turns DMA off for D; either way the
+   caller should fall back to PIO.
+   D's channel lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t dir = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status;
+
+  if (!d->dma || !is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1) != 0)
+    return false;
+  ASSERT (cnt >= 1 && cnt <= MAX_COMMAND_SECTORS);
+
+  /* Point the controller at a PRD table describing BUFFER and
+     clear any stale error or interrupt status.  The status
+     register's other bits must be written back unchanged. */
+  build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), dir);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_IRQ);
+
+  /* Start the disk, then the DMA engine, and wait for the
+     completion interrupt. */
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), dir | BM_CMD_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), dir);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_IRQ);
+  if ((bm_status & BM_STA_ERR) != 0 || (inb (reg_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA failed, sector=%"PRDSNu", switching to PIO\n",
+              d->name, sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/** Fills in channel C's PRD table to describe the SIZE bytes at
+   BUFFER.  Each entry covers the part of BUFFER within a single
+   page, so no entry crosses the 64 kB boundary that PRDs may not
+   cross. */
+static void
+build_prdt (struct channel *c, void *buffer, size_t size)
+{
+  struct prd *prd = c->prdt;
+  uint8_t *p = buffer;
+
+  ASSERT (size > 0);
+  while (size > 0)
+    {
+      size_t chunk = PGSIZE - pg_ofs (p);
+      if (chunk > size)
+        chunk = size;
+
+      prd->addr = vtop (p);
+      prd->size = chunk;
+      prd->flags = 0;
+
+      p += chunk;
+      size -= chunk;
+      if (size == 0)
+        prd->flags = PRD_EOT;
+      prd++;
+    }
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
 /** Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between 1
+   and MAX_COMMAND_SECTORS, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_COMMAND_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -429,6 +755,23 @@ output_sector (struct channel *c, const void *sector)
 {
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
+
+/** Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+input_sectors (struct channel *c, void *sectors, size_t cnt)
+{
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
+}
+
+/** Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode. */
+static void
+output_sectors (struct channel *c, const void *sectors, size_t cnt)
+{
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
+}
 
 /** Low-level ATA primitives. */
 
@@ -317,8 +317,42 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/** Reads CNT sectors starting at SECTOR from partition P into
+   BUFFER, passing them to the underlying device in one request. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector, size_t cnt,
+                         void *buffer)
+{
+  struct partition *p = p_;
+  block_read_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/** Writes CNT sectors starting at SECTOR to partition P from
+   BUFFER, passing them to the underlying device in one
+   request. */
+static void
+partition_write_multiple (void *p_, block_sector_t sector, size_t cnt,
+                          const void *buffer)
+{
+  struct partition *p = p_;
+  block_write_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/** Passes REQUEST, addressed to partition P, on to the
+   underlying device so that it joins that device's queue. */
+static void
+partition_submit (void *p_, struct block_request *request)
+{
+  struct partition *p = p_;
+  request->sector += p->start;
+  block_submit (p->block, request);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multiple,
+    partition_write_multiple,
+    partition_submit
   };
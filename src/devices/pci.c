@@ -0,0 +1,171 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/** Access to PCI configuration space through configuration
+   mechanism #1, the pair of I/O ports that every PC chipset
+   since the early 1990s provides.  See [PCI] 3.2.2.3.2. */
+
+/** Configuration mechanism #1 I/O ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /**< Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc           /**< Reads or writes it. */
+
+/** Vendor ID read back from a slot with nothing in it. */
+#define PCI_NO_VENDOR 0xffff
+
+/** Tells whether DEV is the kind of function being searched for. */
+typedef bool match_func (const struct pci_dev *dev, const void *aux);
+
+static uint32_t config_address (uint8_t bus, uint8_t slot, uint8_t func,
+                                uint8_t reg);
+static bool probe (uint8_t bus, uint8_t slot, uint8_t func,
+                   struct pci_dev *);
+static bool find (match_func *, const void *aux, int idx, struct pci_dev *);
+
+/** Matches functions whose base class and subclass are the two
+   bytes in AUX. */
+static bool
+match_class (const struct pci_dev *dev, const void *aux)
+{
+  const uint8_t *class = aux;
+  return dev->class == class[0] && dev->subclass == class[1];
+}
+
+/** Matches functions whose vendor and device IDs are the two
+   words in AUX. */
+static bool
+match_id (const struct pci_dev *dev, const void *aux)
+{
+  const uint16_t *id = aux;
+  return dev->vendor_id == id[0] && dev->device_id == id[1];
+}
+
+/** Searches every PCI bus for the first function with the given
+   base CLASS and SUBCLASS code.  If one is found, stores it in
+   *DEV and returns true; otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *dev)
+{
+  const uint8_t aux[2] = {class, subclass};
+  return find (match_class, aux, 0, dev);
+}
+
+/** Searches every PCI bus for the function with the given
+   VENDOR_ID and DEVICE_ID, skipping the first IDX such
+   functions, so that IDX = 0, 1, 2, ... enumerates all of them.
+   If one is found, stores it in *DEV and returns true;
+   otherwise, returns false. */
+bool
+pci_find_id (uint16_t vendor_id, uint16_t device_id, int idx,
+             struct pci_dev *dev)
+{
+  const uint16_t aux[2] = {vendor_id, device_id};
+  return find (match_id, aux, idx, dev);
+}
+
+/** Reads the 32-bit configuration register at offset REG, which
+   must be a multiple of 4, from DEV. */
+uint32_t
+pci_read_config (const struct pci_dev *dev, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        config_address (dev->bus, dev->slot, dev->func, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/** Writes VALUE to the 32-bit configuration register at offset
+   REG, which must be a multiple of 4, in DEV. */
+void
+pci_write_config (const struct pci_dev *dev, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        config_address (dev->bus, dev->slot, dev->func, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/** Returns base address register BAR (0...5) of DEV with the
+   type bits masked off, leaving just the address.  The result
+   is an I/O port for I/O BARs and a physical address for memory
+   BARs. */
+uint32_t
+pci_get_bar (const struct pci_dev *dev, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (dev, PCI_REG_BAR0 + bar * 4);
+  return value & 1 ? value & ~(uint32_t) 0x3 : value & ~(uint32_t) 0xf;
+}
+
+/** Lets DEV initiate its own transfers to and from memory, as
+   DMA engines must.  Also enables its I/O and memory decoders. */
+void
+pci_enable_master (const struct pci_dev *dev)
+{
+  uint32_t cmd = pci_read_config (dev, PCI_REG_COMMAND);
+  cmd |= PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_MASTER;
+  pci_write_config (dev, PCI_REG_COMMAND, cmd & 0xffff);
+}
+
+/** Searches every PCI bus, in order, for the functions that
+   MATCH accepts given AUX.  Skips the first IDX of them, then
+   stores the next in *DEV and returns true, or returns false if
+   there are no more. */
+static bool
+find (match_func *match, const void *aux, int idx, struct pci_dev *dev)
+{
+  int bus, slot, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (slot = 0; slot < 32; slot++)
+      for (func = 0; func < 8; func++)
+        {
+          if (!probe (bus, slot, func, dev))
+            {
+              /* An empty function 0 means an empty slot. */
+              if (func == 0)
+                break;
+              continue;
+            }
+          if (match (dev, aux) && idx-- == 0)
+            return true;
+
+          /* Only multi-function devices have functions 1...7. */
+          if (func == 0
+              && !(pci_read_config (dev, PCI_REG_HEADER) & 0x00800000))
+            break;
+        }
+  return false;
+}
+
+/** Returns the value to write to PCI_CONFIG_ADDRESS to select
+   register REG of the given function. */
+static uint32_t
+config_address (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg)
+{
+  ASSERT (slot < 32 && func < 8 && reg % 4 == 0);
+  return (1u << 31) | (bus << 16) | (slot << 11) | (func << 8) | reg;
+}
+
+/** Fills in DEV for function FUNC of SLOT on BUS and returns
+   true, or returns false if there is no such function. */
+static bool
+probe (uint8_t bus, uint8_t slot, uint8_t func, struct pci_dev *dev)
+{
+  uint32_t id, class;
+
+  dev->bus = bus;
+  dev->slot = slot;
+  dev->func = func;
+  id = pci_read_config (dev, PCI_REG_ID);
+  if ((id & 0xffff) == PCI_NO_VENDOR)
+    return false;
+
+  class = pci_read_config (dev, PCI_REG_CLASS);
+  dev->vendor_id = id & 0xffff;
+  dev->device_id = id >> 16;
+  dev->class = class >> 24;
+  dev->subclass = (class >> 16) & 0xff;
+  dev->prog_if = (class >> 8) & 0xff;
+  return true;
+}
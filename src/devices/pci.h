@@ -0,0 +1,43 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** A PCI function, identified by its bus, slot and function
+   numbers, along with a copy of its identifying registers. */
+struct pci_dev
+  {
+    uint8_t bus;                /**< Bus number, 0...255. */
+    uint8_t slot;               /**< Device number on the bus, 0...31. */
+    uint8_t func;               /**< Function number, 0...7. */
+    uint16_t vendor_id;         /**< Vendor ID. */
+    uint16_t device_id;         /**< Device ID. */
+    uint8_t class;              /**< Base class code. */
+    uint8_t subclass;           /**< Subclass code. */
+    uint8_t prog_if;            /**< Programming interface. */
+  };
+
+/** Configuration space register offsets. */
+#define PCI_REG_ID 0x00         /**< Vendor ID (low), device ID (high). */
+#define PCI_REG_COMMAND 0x04    /**< Command (16 bits). */
+#define PCI_REG_CLASS 0x08      /**< Revision, prog if, subclass, class. */
+#define PCI_REG_HEADER 0x0c     /**< Header type is bits 16...23. */
+#define PCI_REG_BAR0 0x10       /**< First of six base address registers. */
+#define PCI_REG_IRQ 0x3c        /**< Interrupt line (low byte). */
+
+/** Command register bits. */
+#define PCI_CMD_IO 0x0001       /**< Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002   /**< Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /**< Allow bus mastering. */
+
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *);
+bool pci_find_id (uint16_t vendor_id, uint16_t device_id, int idx,
+                  struct pci_dev *);
+
+uint32_t pci_read_config (const struct pci_dev *, uint8_t reg);
+void pci_write_config (const struct pci_dev *, uint8_t reg, uint32_t);
+uint32_t pci_get_bar (const struct pci_dev *, int bar);
+void pci_enable_master (const struct pci_dev *);
+
+#endif /**< devices/pci.h */
@@ -1,5 +1,6 @@
 #include "devices/pit.h"
 #include <debug.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
@@ -11,9 +12,6 @@
 #define PIT_PORT_CONTROL          0x43                /**< Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /**< Counter port. */
 
-/** PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /** Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +79,54 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/** Starts CHANNEL counting down COUNT PIT cycles, between 1 and
+   65536, in one shot (mode 0).  The output goes high when the
+   count runs out, raising an interrupt on channel 0, and stays
+   high until the channel is programmed again.  The counter keeps
+   counting down after that, wrapping around from 0 to 65535, so
+   pit_read_count() can still tell how long ago the count ran
+   out. */
+void
+pit_start_oneshot (int channel, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (count >= 1 && count <= 65536);
+
+  /* Mode 0 is 0 in bits 1...3 of the control word.  A count of
+     65536 is written as 0. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/** Returns the count in CHANNEL's counter, between 1 and 65536.
+   If OUTPUT is nonnull, stores the channel's output level in
+   *OUTPUT, latched at the same instant as the count. */
+unsigned
+pit_read_count (int channel, bool *output)
+{
+  enum intr_level old_level;
+  unsigned count;
+  uint8_t status;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Read-back command latching both the status and the count of
+     CHANNEL.  The status byte comes first, then the count, low
+     byte first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+
+  if (output != NULL)
+    *output = (status & 0x80) != 0;
+  return count != 0 ? count : 65536;
+}
@@ -0,0 +1,129 @@
+#include "devices/ramdisk.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/** Sectors per page of RAM disk memory. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/** A RAM disk.  Its memory is a set of kernel pages, which need
+   not be contiguous, so that large disks can be had even when
+   the kernel pool is fragmented. */
+struct ramdisk
+  {
+    size_t page_cnt;            /**< Number of pages. */
+    uint8_t **pages;            /**< Array of PAGE_CNT pages. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/** Creates and registers a zero-filled RAM disk of KB kB, rounded
+   up to a whole number of pages, named "ram0".  Its contents are
+   lost at shutdown.  Returns the new block device. */
+struct block *
+ramdisk_init (size_t kb)
+{
+  struct ramdisk *rd;
+  size_t i;
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    PANIC ("Failed to allocate memory for RAM disk descriptor");
+  rd->page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  if (rd->page_cnt == 0)
+    PANIC ("RAM disk size must be nonzero");
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk page table");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("Out of memory for %zu kB RAM disk", kb);
+    }
+
+  return block_register ("ram0", BLOCK_RAW, "RAM disk",
+                         rd->page_cnt * SECTORS_PER_PAGE,
+                         &ramdisk_operations, rd);
+}
+
+/** Returns the address of SECTOR within RAM disk RD. */
+static uint8_t *
+sector_address (const struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/** Reads sector SECTOR from RAM disk RD into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  struct ramdisk *rd = rd_;
+  memcpy (buffer, sector_address (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/** Write sector SECTOR to RAM disk RD from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  struct ramdisk *rd = rd_;
+  memcpy (sector_address (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/** Reads CNT sectors starting at SECTOR from RAM disk RD into
+   BUFFER, copying up to a page at a time. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sector, size_t cnt,
+                       void *buffer)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      size_t run = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (run > cnt)
+        run = cnt;
+      memcpy (p, sector_address (rd, sector), run * BLOCK_SECTOR_SIZE);
+      p += run * BLOCK_SECTOR_SIZE;
+      sector += run;
+      cnt -= run;
+    }
+}
+
+/** Writes CNT sectors starting at SECTOR to RAM disk RD from
+   BUFFER, copying up to a page at a time. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sector, size_t cnt,
+                        const void *buffer)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      size_t run = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (run > cnt)
+        run = cnt;
+      memcpy (sector_address (rd, sector), p, run * BLOCK_SECTOR_SIZE);
+      p += run * BLOCK_SECTOR_SIZE;
+      sector += run;
+      cnt -= run;
+    }
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
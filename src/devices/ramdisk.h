@@ -0,0 +1,8 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stddef.h>
+
+struct block *ramdisk_init (size_t kb);
+
+#endif /**< devices/ramdisk.h */
@@ -1,7 +1,6 @@
 #include "devices/serial.h"
 #include <debug.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -44,18 +43,40 @@
 /** MODEM Control Register. */
 #define MCR_OUT2 0x08           /**< Output line 2. */
 
+/** FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /**< Enable the receive and transmit FIFOs. */
+#define FCR_CLEAR 0x06          /**< Clear both FIFOs. */
+
 /** Line Status Register. */
 #define LSR_DR 0x01             /**< Data Ready: received data byte is in RBR. */
 #define LSR_THRE 0x20           /**< THR Empty. */
 
+/** Bytes the transmit FIFO holds.  Once THR Empty is set, this
+   many bytes may be written at once. */
+#define FIFO_SIZE 16
+
 /** Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/** Data to be transmitted. */
-static struct intq txq;
+/** Data to be transmitted, in a ring drained by the serial
+   interrupt.  Large enough that a process writing a page of
+   output to the console need not wait for the UART.  TXQ_HEAD
+   and TXQ_TAIL count bytes ever added and removed, so their
+   difference is the number of bytes queued. */
+#define TXQ_SIZE 4096
+static uint8_t txq[TXQ_SIZE];
+static unsigned txq_head, txq_tail;
+
+/** Threads waiting for room in the transmit ring, which are
+   woken once it is half empty. */
+static struct semaphore txq_space;
+static int txq_waiters;
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static bool txq_empty (void);
+static bool txq_full (void);
+static uint8_t txq_getc (void);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -71,7 +92,6 @@ init_poll (void)
   outb (FCR_REG, 0);                    /**< Disable FIFO. */
   set_serial (9600);                    /**< 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /**< Required to enable interrupts. */
-  intq_init (&txq);
   mode = POLL;
 } 
 
@@ -87,6 +107,8 @@ serial_init_queue (void)
     init_poll ();
   ASSERT (mode == POLL);
 
+  sema_init (&txq_space, 0);
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR);
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
   mode = QUEUE;
   old_level = intr_disable ();
@@ -97,33 +119,67 @@ serial_init_queue (void)
 /** Sends BYTE to the serial port. */
 void
 serial_putc (uint8_t byte) 
+{
+  serial_write (&byte, 1);
+}
+
+/** Sends the N bytes in BUFFER to the serial port.
+
+   In queued mode the bytes are copied into the transmit ring and
+   the serial interrupt sends them, so this returns as soon as
+   they fit.  A thread that finds the ring full sleeps until the
+   interrupt handler has made room. */
+void
+serial_write (const uint8_t *buffer, size_t n) 
 {
   enum intr_level old_level = intr_disable ();
 
   if (mode != QUEUE)
     {
       /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit. */
       if (mode == UNINIT)
         init_poll ();
-      putc_poll (byte); 
+      while (n-- > 0)
+        putc_poll (*buffer++); 
     }
   else 
     {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
+      while (n > 0) 
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
+          bool was_empty = txq_empty ();
+
+          if (txq_full ()) 
+            {
+              if (old_level == INTR_OFF) 
+                {
+                  /* Interrupts are off and the transmit queue is
+                     full.  If we wanted to wait for the queue to
+                     empty, we'd have to reenable interrupts.
+                     That's impolite, so we'll send a character
+                     via polling instead. */
+                  putc_poll (txq_getc ()); 
+                }
+              else
+                {
+                  txq_waiters++;
+                  sema_down (&txq_space);
+                }
+              continue;
+            }
+
+          while (n > 0 && !txq_full ()) 
+            {
+              txq[txq_head++ % TXQ_SIZE] = *buffer++;
+              n--;
+            }
+
+          /* The transmit interrupt is enabled whenever the ring is
+             not empty, so the register only needs updating when
+             it was. */
+          if (was_empty)
+            write_ier ();
         }
-
-      intq_putc (&txq, byte); 
-      write_ier ();
     }
   
   intr_set_level (old_level);
@@ -135,8 +191,8 @@ void
 serial_flush (void) 
 {
   enum intr_level old_level = intr_disable ();
-  while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+  while (!txq_empty ())
+    putc_poll (txq_getc ());
   intr_set_level (old_level);
 }
 
@@ -182,7 +238,7 @@ write_ier (void)
 
   /* Enable transmit interrupt if we have any characters to
      transmit. */
-  if (!intq_empty (&txq))
+  if (!txq_empty ())
     ier |= IER_XMIT;
 
   /* Enable receive interrupt if we have room to store any
@@ -205,6 +261,30 @@ putc_poll (uint8_t byte)
   outb (THR_REG, byte);
 }
 
+/** Returns true if the transmit ring is empty. */
+static bool
+txq_empty (void) 
+{
+  return txq_head == txq_tail;
+}
+
+/** Returns true if the transmit ring is full. */
+static bool
+txq_full (void) 
+{
+  return txq_head - txq_tail == TXQ_SIZE;
+}
+
+/** Removes and returns the oldest byte in the transmit ring,
+   which must not be empty. */
+static uint8_t
+txq_getc (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!txq_empty ());
+  return txq[txq_tail++ % TXQ_SIZE];
+}
+
 /** Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED) 
@@ -218,10 +298,18 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* If the transmit FIFO is empty, refill it from the ring. */
+  if ((inb (LSR_REG) & LSR_THRE) != 0) 
+    {
+      int i;
+      for (i = 0; i < FIFO_SIZE && !txq_empty (); i++)
+        outb (THR_REG, txq_getc ());
+    }
+
+  /* Wake up writers once the ring is half empty. */
+  if (txq_waiters > 0 && txq_head - txq_tail <= TXQ_SIZE / 2)
+    for (; txq_waiters > 0; txq_waiters--)
+      sema_up (&txq_space);
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
@@ -8,6 +8,7 @@
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/strace.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
@@ -137,5 +138,6 @@ print_stats (void)
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  strace_print_stats ();
 #endif
 }
@@ -0,0 +1,220 @@
+#include "devices/stripe.h"
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+/** Sectors per chunk.  Consecutive chunks of the striped device
+   go to consecutive underlying devices, round-robin. */
+#define STRIPE_CHUNK 16
+
+/** Maximum number of underlying devices. */
+#define STRIPE_MAX_DEVS 4
+
+/** A striped (RAID-0) block device. */
+struct stripe
+  {
+    struct block *devs[STRIPE_MAX_DEVS];  /**< Underlying devices. */
+    size_t dev_cnt;                       /**< Number of devices. */
+  };
+
+/** A request to a striped device, in progress.  Each piece of the
+   request that lies within one chunk becomes a separate request
+   to that chunk's device, so that the pieces on different
+   devices run concurrently. */
+struct stripe_io
+  {
+    struct block_request *request;      /**< Request to the stripe. */
+    size_t pending;                     /**< Pieces not yet complete. */
+    struct block_request pieces[];      /**< Requests to devices. */
+  };
+
+static struct block_operations stripe_operations;
+
+/** Finds where SECTOR of stripe S lives.  Returns the underlying
+   device and stores the sector within it in *DEV_SECTOR and the
+   number of sectors left in its chunk, starting from SECTOR, in
+   *RUN. */
+static struct block *
+map_sector (const struct stripe *s, block_sector_t sector,
+            block_sector_t *dev_sector, size_t *run)
+{
+  block_sector_t chunk = sector / STRIPE_CHUNK;
+  block_sector_t ofs = sector % STRIPE_CHUNK;
+
+  *dev_sector = chunk / s->dev_cnt * STRIPE_CHUNK + ofs;
+  *run = STRIPE_CHUNK - ofs;
+  return s->devs[chunk % s->dev_cnt];
+}
+
+/** Creates and registers a striped block device over the block
+   devices named in DEV_NAMES, which is a comma-separated list.
+   The devices should be otherwise unused, such as whole disks
+   holding no partitions.  Returns the new device. */
+struct block *
+stripe_create (char *dev_names)
+{
+  struct stripe *s;
+  block_sector_t dev_size = 0;
+  char extra_info[32];
+  char *name, *save_ptr;
+  size_t i;
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for stripe descriptor");
+  s->dev_cnt = 0;
+
+  for (name = strtok_r (dev_names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *dev = block_get_by_name (name);
+      if (dev == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      if (s->dev_cnt >= STRIPE_MAX_DEVS)
+        PANIC ("Too many devices to stripe (limit %d)", STRIPE_MAX_DEVS);
+      for (i = 0; i < s->dev_cnt; i++)
+        if (s->devs[i] == dev)
+          PANIC ("Block device \"%s\" striped twice", name);
+      if (s->dev_cnt == 0 || block_size (dev) < dev_size)
+        dev_size = block_size (dev);
+      s->devs[s->dev_cnt++] = dev;
+    }
+  if (s->dev_cnt == 0)
+    PANIC ("No devices to stripe");
+
+  /* Use whole chunks of the smallest device's size from each. */
+  dev_size -= dev_size % STRIPE_CHUNK;
+  snprintf (extra_info, sizeof extra_info, "%zu-way, %d kB chunks",
+            s->dev_cnt, STRIPE_CHUNK * BLOCK_SECTOR_SIZE / 1024);
+  return block_register ("stripe", BLOCK_FILESYS, extra_info,
+                         dev_size * s->dev_cnt, &stripe_operations, s);
+}
+
+/** Reads sector SECTOR from stripe S into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer)
+{
+  struct stripe *s = s_;
+  block_sector_t dev_sector;
+  size_t run;
+  struct block *dev = map_sector (s, sector, &dev_sector, &run);
+
+  block_read (dev, dev_sector, buffer);
+}
+
+/** Write sector SECTOR to stripe S from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the underlying
+   device has acknowledged receiving the data. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer)
+{
+  struct stripe *s = s_;
+  block_sector_t dev_sector;
+  size_t run;
+  struct block *dev = map_sector (s, sector, &dev_sector, &run);
+
+  block_write (dev, dev_sector, buffer);
+}
+
+/** Called when one piece of the stripe request IO_ completes.
+   Completes the whole request after the last piece. */
+static void
+piece_done (struct block_request *piece UNUSED, void *io_)
+{
+  struct stripe_io *io = io_;
+  enum intr_level old_level;
+  bool last;
+
+  /* Pieces on different devices complete in different
+     dispatcher threads. */
+  old_level = intr_disable ();
+  last = --io->pending == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    {
+      block_complete (io->request);
+      free (io);
+    }
+}
+
+/** Splits REQUEST into its pieces within each chunk and submits
+   each to the underlying device that holds it. */
+static void
+stripe_submit (void *s_, struct block_request *request)
+{
+  struct stripe *s = s_;
+  struct stripe_io *io;
+  block_sector_t sector, dev_sector;
+  uint8_t *buffer;
+  size_t left, run, piece_cnt, i;
+  struct block *dev;
+
+  /* Count the pieces. */
+  piece_cnt = 0;
+  for (sector = request->sector, left = request->cnt; left > 0;
+       sector += run, left -= run)
+    {
+      map_sector (s, sector, &dev_sector, &run);
+      if (run > left)
+        run = left;
+      piece_cnt++;
+    }
+
+  io = malloc (sizeof *io + piece_cnt * sizeof *io->pieces);
+  if (io == NULL)
+    {
+      /* Out of memory: transfer the pieces one at a time. */
+      buffer = request->buffer;
+      for (sector = request->sector, left = request->cnt; left > 0;
+           sector += run, left -= run, buffer += run * BLOCK_SECTOR_SIZE)
+        {
+          dev = map_sector (s, sector, &dev_sector, &run);
+          if (run > left)
+            run = left;
+          if (request->write)
+            block_write_multiple (dev, dev_sector, run, buffer);
+          else
+            block_read_multiple (dev, dev_sector, run, buffer);
+        }
+      block_complete (request);
+      return;
+    }
+
+  /* Set up all the pieces before submitting any, since the last
+     one to complete frees IO. */
+  io->request = request;
+  io->pending = piece_cnt;
+  buffer = request->buffer;
+  for (sector = request->sector, left = request->cnt, i = 0; left > 0;
+       sector += run, left -= run, buffer += run * BLOCK_SECTOR_SIZE, i++)
+    {
+      map_sector (s, sector, &dev_sector, &run);
+      if (run > left)
+        run = left;
+      block_request_init (&io->pieces[i], request->write, dev_sector, run,
+                          buffer, piece_done, io);
+    }
+  for (sector = request->sector, left = request->cnt, i = 0; i < piece_cnt;
+       i++)
+    {
+      dev = map_sector (s, sector, &dev_sector, &run);
+      if (run > left)
+        run = left;
+      sector += run;
+      left -= run;
+      block_submit (dev, &io->pieces[i]);
+    }
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    NULL,
+    NULL,
+    stripe_submit
+  };
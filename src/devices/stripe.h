@@ -0,0 +1,8 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+struct block;
+
+struct block *stripe_create (char *dev_names);
+
+#endif /**< devices/stripe.h */
@@ -20,18 +20,71 @@
 /** Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/** Number of timer interrupts since OS booted. */
+static int64_t interrupts;
+
+/** PIT cycles per timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/** Tickless mode.  When no thread is ready to run, the running
+   thread, or the idle thread, needs no tick until the next timer
+   expires, so the PIT is switched from its periodic tick to a
+   one-shot that runs out at that timer's tick, or as far ahead as
+   its 16-bit counter allows.  The interrupt at its end runs all
+   the ticks it covered and restarts the periodic tick.
+
+   Time is kept in PIT cycles since boot, read back from the
+   counter, so the clock is right whether the PIT is ticking or
+   not.  Reprogramming the PIT starts its counter over, so the
+   cycles between reading the counter and restarting it are
+   measured with the TSC and added in. */
+static bool nohz_enabled;       /**< Calibrated, so ticks may be skipped? */
+static bool oneshot;            /**< Is the PIT running a one-shot? */
+static int64_t nohz_end;        /**< Tick at which the one-shot runs out. */
+static int64_t pit_time;        /**< PIT cycles from boot to the start of
+                                     the PIT's current count. */
+static unsigned pit_count;      /**< Cycles in the current one-shot. */
+static uint64_t tsc_per_tick;   /**< TSC cycles per tick. */
+
 /** Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/** Hierarchical timer wheel.  Level 0 has a slot for each of the
+   next WHEEL_SIZE ticks.  Each slot of level L covers WHEEL_SIZE
+   times as many ticks as a slot of level L - 1, and when the
+   wheel reaches the start of that span its timers are cascaded
+   down into lower levels.  Adding a timer and running one each
+   take constant time, and a timer is cascaded at most
+   WHEEL_LEVELS - 1 times. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+/* Timers further out than this wait in the last level's furthest
+   slot and are re-filed when it is cascaded. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* The earliest tick whose timers have not run yet. */
+static int64_t wheel_time;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
 static void real_time_sleep(int64_t num, int32_t denom);
 static void real_time_delay(int64_t num, int32_t denom);
 
-static bool is_less_than(struct list_elem *x, struct list_elem *y); // added to sort threads
-struct list list_threads; // added to store list of threads
+static void wheel_insert(struct timer *timer);
+static void wheel_cascade(int level, int slot);
+static void wheel_advance(void);
+static void wake_thread(void *t);
+static void tick(void);
+static bool nohz_enter(int64_t now, uint64_t tsc);
+static int64_t clock_read(uint64_t *tsc);
+static void clock_restart(int64_t now, uint64_t tsc, unsigned count);
 
 /** Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -39,8 +92,11 @@ void timer_init(void) {
   pit_configure_channel(0, 2, TIMER_FREQ);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 
-  // init the list of threads
-  list_init(&list_threads);
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+      list_init(&wheel[level][slot]);
+    }
+  }
 }
 
 /** Calibrates loops_per_tick, used to implement brief delays. */
@@ -50,6 +106,14 @@ void timer_calibrate(void) {
   ASSERT(intr_get_level() == INTR_ON);
   printf("Calibrating timer...  ");
 
+  // Time the TSC against the ticks the calibration takes
+  int64_t start = ticks;
+  while (ticks == start) {
+    barrier();
+  }
+  start = ticks;
+  uint64_t tsc = timer_cycles();
+
   /* Approximate loops_per_tick as the largest power-of-two
      still less than one timer tick. */
   loops_per_tick = 1u << 10;
@@ -65,12 +129,22 @@ void timer_calibrate(void) {
       loops_per_tick |= test_bit;
 
   printf("%'" PRIu64 " loops/s.\n", (uint64_t)loops_per_tick * TIMER_FREQ);
+
+  start = ticks - start;
+  tsc_per_tick = (timer_cycles() - tsc) / start;
+
+  // Calibration counted on an interrupt every tick
+  nohz_enabled = tsc_per_tick != 0;
 }
 
 /** Returns the number of timer ticks since the OS booted. */
 int64_t timer_ticks(void) {
   enum intr_level old_level = intr_disable();
   int64_t t = ticks;
+  // Count the ticks already passed in a one-shot
+  if (oneshot) {
+    t = clock_read(NULL) / TICK_CYCLES;
+  }
   intr_set_level(old_level);
   return t;
 }
@@ -79,41 +153,145 @@ int64_t timer_ticks(void) {
    should be a value once returned by timer_ticks(). */
 int64_t timer_elapsed(int64_t then) { return timer_ticks() - then; }
 
-bool is_less_than(struct list_elem *x, struct list_elem *y) {
-  struct thread *x_temp;
-  struct thread *y_temp;
+/** Returns the processor's time-stamp counter, which counts CPU
+   cycles.  Much finer-grained than timer ticks, for measuring
+   short intervals. */
+uint64_t timer_cycles(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/** Initializes TIMER, which is not yet added, to call FUNC with
+   AUX when it expires. */
+void timer_setup(struct timer *timer, timer_func *func, void *aux) {
+  ASSERT(func != NULL);
+
+  timer->func = func;
+  timer->aux = aux;
+  timer->pending = false;
+}
+
+/** Adds TIMER, which must not be pending, to expire at tick
+   EXPIRES, a value comparable with timer_ticks().  A time already
+   past expires at the next tick.  May be called from an interrupt
+   handler, including from a timer's own function. */
+void timer_add(struct timer *timer, int64_t expires) {
+  ASSERT(!timer->pending);
+
+  enum intr_level old_level = intr_disable();
+  timer->expires = expires;
+  timer->pending = true;
+  wheel_insert(timer);
+  // A timer due before the one-shot runs out needs its tick
+  if (oneshot && expires < nohz_end) {
+    timer_nohz_exit();
+  }
+  intr_set_level(old_level);
+}
+
+/** Cancels TIMER.  Returns true if it was pending, false if it had
+   already expired or was never added. */
+bool timer_cancel(struct timer *timer) {
+  enum intr_level old_level = intr_disable();
+  bool was_pending = timer->pending;
+  if (was_pending) {
+    list_remove(&timer->elem);
+    timer->pending = false;
+  }
+  intr_set_level(old_level);
+  return was_pending;
+}
+
+/** Returns true if TIMER has been added and has not yet expired
+   or been cancelled. */
+bool timer_pending(const struct timer *timer) { return timer->pending; }
+
+/** Files TIMER in the wheel slot for its expiry time: the lowest
+   level whose span reaches it.  Interrupts must be off. */
+static void wheel_insert(struct timer *timer) {
+  int64_t expires = timer->expires < wheel_time ? wheel_time : timer->expires;
+  int64_t delta = expires - wheel_time;
+  int level = 0;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (delta >= WHEEL_SPAN) {
+    expires = wheel_time + WHEEL_SPAN - 1;
+    delta = WHEEL_SPAN - 1;
+  }
+  while (delta >= (int64_t) 1 << (WHEEL_BITS * (level + 1))) {
+    level++;
+  }
+  int slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  list_push_back(&wheel[level][slot], &timer->elem);
+}
 
-  x_temp = list_entry(x, struct thread, elem);
-  y_temp = list_entry(y, struct thread, elem);
+/** Re-files every timer in SLOT of LEVEL, whose span starts at
+   wheel_time, into the levels below. */
+static void wheel_cascade(int level, int slot) {
+  struct list timers;
 
-  return (x_temp->ticks_to_sleep < y_temp->ticks_to_sleep);
+  list_init(&timers);
+  if (!list_empty(&wheel[level][slot])) {
+    list_splice(list_end(&timers), list_begin(&wheel[level][slot]),
+                list_end(&wheel[level][slot]));
+  }
+  while (!list_empty(&timers)) {
+    wheel_insert(list_entry(list_pop_front(&timers), struct timer, elem));
+  }
 }
 
+/** Runs the timers that expire at tick wheel_time, then advances
+   wheel_time.  A timer function that adds a timer for the current
+   tick or earlier gets it run at the next tick. */
+static void wheel_advance(void) {
+  int64_t now = wheel_time;
+  struct list *slot = &wheel[0][now & WHEEL_MASK];
+  struct list expired;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  /* At the start of each level's span, bring its timers down. */
+  for (int level = 1; level < WHEEL_LEVELS; level++) {
+    if ((now & (((int64_t) 1 << (WHEEL_BITS * level)) - 1)) != 0) {
+      break;
+    }
+    wheel_cascade(level, (now >> (WHEEL_BITS * level)) & WHEEL_MASK);
+  }
+
+  list_init(&expired);
+  if (!list_empty(slot)) {
+    list_splice(list_end(&expired), list_begin(slot), list_end(slot));
+  }
+  wheel_time = now + 1;
+
+  while (!list_empty(&expired)) {
+    struct timer *timer = list_entry(list_pop_front(&expired), struct timer, elem);
+    timer->pending = false;
+    timer->func(timer->aux);
+  }
+}
+
+/** Timer function that wakes the sleeping thread T. */
+static void wake_thread(void *t) { thread_unblock(t); }
+
 /** Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void timer_sleep(int64_t ticks) {
+  struct timer timer;
 
   ASSERT(intr_get_level() == INTR_ON);
-  // NOTE: implement a non-busy wait
-  // while (timer_elapsed(start) < ticks)
-  //   thread_yield();
-  // Referenced solution -- to disable interrupts -- from:
-  // https://souzanurafrianto.wordpress.com/2011/05/06/avoiding-busy-wait-in-timer_sleep-on-pintos/
-  // Referenced solution to sort timers from:
-  // Referenced https://github.com/Ma06RC/Pintos-Busy-Wait-/blob/master/src/devices/timer.cycles
-
-  // get current thread
-  struct thread *t = thread_current();
-
-  // store the time for when the thread should awaken
-  t->ticks_to_sleep = timer_ticks() + ticks;
-  
-  // disabling interrupts so can block threads
+  if (ticks <= 0) {
+    return;
+  }
+
+  // The timer lives on this thread's stack, which stays put while
+  // the thread is blocked
+  timer_setup(&timer, wake_thread, thread_current());
   enum intr_level old_level = intr_disable();
-  // insert the list in an ordered fashion, from lib/kernel/list.h
-  list_insert_ordered(&list_threads, &t->elem, is_less_than, NULL);
+  timer_add(&timer, timer_ticks() + ticks);
   thread_block();
-  // set interrupts back to the previous level
   intr_set_level(old_level);
 }
 
@@ -156,35 +334,140 @@ void timer_udelay(int64_t us) { real_time_delay(us, 1000 * 1000); }
    instead if interrupts are enabled.*/
 void timer_ndelay(int64_t ns) { real_time_delay(ns, 1000 * 1000 * 1000); }
 
-/** Prints timer statistics. */
-void timer_print_stats(void) {
-  printf("Timer: %" PRId64 " ticks\n", timer_ticks());
+/** Leaves tickless mode, if the PIT is running a one-shot:
+   makes it run out at the next tick boundary instead, so that the
+   interrupt handler runs the ticks passed and restarts the
+   periodic tick.  Interrupts must be off. */
+void timer_nohz_exit(void) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (!oneshot) {
+    return;
+  }
+
+  uint64_t tsc;
+  int64_t now = clock_read(&tsc);
+  int64_t next = now / TICK_CYCLES + 1;
+  // A one-shot that runs out by then, or has already, is left be
+  if (next >= nohz_end) {
+    return;
+  }
+  clock_restart(now, tsc, next * TICK_CYCLES - now);
+  nohz_end = next;
 }
 
-/** Timer interrupt handler. */
-static void timer_interrupt(struct intr_frame *args UNUSED) {
+/** Returns the number of PIT cycles since boot, and if TSC is
+   nonnull stores the TSC read just after the PIT in *TSC.
+   Interrupts must be off. */
+static int64_t clock_read(uint64_t *tsc) {
+  bool output;
+  unsigned count = pit_read_count(0, &output);
+
+  if (tsc != NULL) {
+    *tsc = timer_cycles();
+  }
+  if (!oneshot) {
+    // The periodic count goes from TICK_CYCLES down to 1
+    return pit_time + TICK_CYCLES - count;
+  } else if (!output) {
+    return pit_time + pit_count - count;
+  } else {
+    // Run out, and counting on down from 65536
+    return pit_time + pit_count + 65536 - count;
+  }
+}
+
+/** Restarts the PIT, whose counter read NOW cycles since boot when
+   the TSC read TSC: as a one-shot of COUNT cycles, or as the
+   periodic tick if COUNT is 0.  Interrupts must be off. */
+static void clock_restart(int64_t now, uint64_t tsc, unsigned count) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (count != 0) {
+    pit_start_oneshot(0, count);
+  } else {
+    pit_configure_channel(0, 2, TIMER_FREQ);
+  }
+  // The counter starts over only now
+  pit_time = now + (timer_cycles() - tsc) * TICK_CYCLES / tsc_per_tick;
+  pit_count = count;
+  oneshot = count != 0;
+}
+
+/** Returns true if the timer wheel may have work at tick T, which
+   must lie less than WHEEL_SIZE ticks ahead. */
+static bool tick_has_work(int64_t t) {
+  return (t & WHEEL_MASK) == 0 || !list_empty(&wheel[0][t & WHEEL_MASK]);
+}
+
+/** Called from the timer interrupt once every tick up to NOW, in
+   PIT cycles read when the TSC read TSC, has run.  If no thread
+   is ready to run, switches the PIT to a one-shot that runs out
+   at the tick of the next timer, and returns true.  Otherwise
+   returns false. */
+static bool nohz_enter(int64_t now, uint64_t tsc) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (!nohz_enabled || !thread_none_ready()) {
+    return false;
+  }
+
+  // The one-shot runs out on a tick boundary and must fit the
+  // PIT's 16-bit counter
+  int64_t first = (ticks + 1) * TICK_CYCLES - now;
+  if (first <= 0 || first > TICK_CYCLES) {
+    return false;
+  }
+  int max = 1 + (65536 - first) / TICK_CYCLES;
+  int n = 1;
+  while (n < max && !tick_has_work(ticks + n)) {
+    n++;
+  }
+  if (n < 2) {
+    return false;
+  }
+
+  clock_restart(now, tsc, first + (n - 1) * TICK_CYCLES);
+  nohz_end = ticks + n;
+  return true;
+}
+
+/** Advances the clock by one tick and runs every timer due by
+   then, waking sleeping threads. */
+static void tick(void) {
   ticks++;
   thread_tick();
+  while (wheel_time <= ticks) {
+    wheel_advance();
+  }
+}
 
-  // modified to check list of threads, and unblock the thread.
-  // while loop cycles through each thread, with longest timer set in the back
+/** Prints timer statistics. */
+void timer_print_stats(void) {
+  printf("Timer: %" PRId64 " ticks, %" PRId64 " interrupts\n",
+         timer_ticks(), interrupts);
+}
 
-  struct thread *t;
+/** Timer interrupt handler. */
+static void timer_interrupt(struct intr_frame *args UNUSED) {
+  bool ran_out = oneshot;
+  uint64_t tsc;
 
-  while(list_size(&list_threads)) {
-    // get thread in front of list
-    t = list_entry(list_front(&list_threads), struct thread, elem);
-    
-    // check if enough time has elapsed to unblock the thread
-    if (timer_ticks() < t->ticks_to_sleep) {
-      break;
-    }
-    
-    list_pop_front(&list_threads);
-    thread_unblock(t);
+  interrupts++;
+  if (!ran_out) {
+    pit_time += TICK_CYCLES;
   }
+  int64_t now = clock_read(&tsc);
 
-
+  // A one-shot that has run out leaves the PIT idle until it is
+  // restarted below; until then timer_nohz_exit() has nothing to do
+  oneshot = false;
+  while (ticks < now / TICK_CYCLES) {
+    tick();
+  }
+  if (!nohz_enter(now, tsc) && ran_out) {
+    clock_restart(now, tsc, 0);
+  }
 }
 
 /** Returns true if LOOPS iterations waits for more than one timer
@@ -1,17 +1,42 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /** Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/** Function called when a kernel timer expires. */
+typedef void timer_func (void *aux);
+
+/** A kernel timer.  When it expires, its function is called with
+   AUX from the timer interrupt handler, with interrupts off, so
+   it must not sleep.  The owner provides the storage, which must
+   stay valid until the timer expires or is cancelled. */
+struct timer
+  {
+    struct list_elem elem;      /**< Element in a timer wheel slot. */
+    int64_t expires;            /**< Tick at which it expires. */
+    timer_func *func;           /**< Function to call. */
+    void *aux;                  /**< Auxiliary data for FUNC. */
+    bool pending;               /**< Added and not yet expired? */
+  };
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+uint64_t timer_cycles (void);
+
+/** Kernel timers. */
+void timer_setup (struct timer *, timer_func *, void *aux);
+void timer_add (struct timer *, int64_t expires);
+bool timer_cancel (struct timer *);
+bool timer_pending (const struct timer *);
 
 /** Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -24,6 +49,9 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/** Tickless operation. */
+void timer_nohz_exit (void);
+
 void timer_print_stats (void);
 
 #endif /**< devices/timer.h */
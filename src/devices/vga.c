@@ -26,6 +26,7 @@ static size_t cx, cy;
    The attribute at (x,y) is fb[y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+static void putc_no_cursor (int c, enum intr_level old_level);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
@@ -56,7 +57,34 @@ vga_putc (int c)
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+  putc_no_cursor (c, old_level);
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/** Writes the N characters in BUFFER to the VGA text display,
+   like vga_putc() for each one, but moving the hardware cursor
+   only once at the end. */
+void
+vga_write (const char *buffer, size_t n) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  init ();
+  while (n-- > 0)
+    putc_no_cursor ((uint8_t) *buffer++, old_level);
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/** Writes C to the framebuffer without updating the hardware
+   cursor.  Interrupts must be off; OLD_LEVEL is the level to
+   restore them to while the speaker beeps. */
+static void
+putc_no_cursor (int c, enum intr_level old_level) 
+{
   switch (c) 
     {
     case '\n':
@@ -95,13 +123,8 @@ vga_putc (int c)
         newline ();
       break;
     }
-
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
 }
-
+
 /** Clears the screen and moves the cursor to the upper left. */
 static void
 cls (void)
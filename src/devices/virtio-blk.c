@@ -0,0 +1,427 @@
+#include "devices/virtio-blk.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <packed.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** Driver for virtio block devices, as provided by QEMU and other
+   virtual machine monitors, through the legacy ("transitional")
+   virtio PCI interface.  See [VIRTIO] sections 2.4 "Virtqueues",
+   4.1.4.8 "Legacy Interfaces: A Note on PCI Device Layout" and
+   5.2 "Block Device".
+
+   Unlike an IDE disk, a virtio disk accepts many requests at
+   once: the driver places each one in a ring shared with the
+   device, which carries them out and reports completions in a
+   second ring, with an interrupt.  So this driver does not use
+   the block layer's request queue; it takes requests straight
+   from block_submit() and completes them from a per-device
+   thread as the device finishes them. */
+
+/** PCI IDs of a transitional virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/** Legacy virtio registers, as offsets from the I/O port in BAR 0. */
+#define REG_DEVICE_FEATURES 0x00        /**< Features device offers. */
+#define REG_GUEST_FEATURES 0x04         /**< Features driver accepts. */
+#define REG_QUEUE_PFN 0x08              /**< Queue physical page number. */
+#define REG_QUEUE_SIZE 0x0c             /**< Entries in queue (16 bits). */
+#define REG_QUEUE_SELECT 0x0e           /**< Queue to configure. */
+#define REG_QUEUE_NOTIFY 0x10           /**< Write queue number to kick. */
+#define REG_STATUS 0x12                 /**< Device status (8 bits). */
+#define REG_ISR 0x13                    /**< Interrupt status, reading acks. */
+#define REG_CAPACITY 0x14               /**< Size in sectors (64 bits). */
+
+/** Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /**< Driver noticed the device. */
+#define STATUS_DRIVER 0x02              /**< Driver knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04           /**< Driver is ready. */
+
+/** Interrupt status bits. */
+#define ISR_QUEUE 0x01                  /**< A queue has new completions. */
+
+/** Virtqueue descriptor flags. */
+#define DESC_NEXT 0x0001                /**< NEXT field is valid. */
+#define DESC_WRITE 0x0002               /**< Device writes this buffer. */
+
+/** Block request types and status. */
+#define VIRTIO_BLK_T_IN 0               /**< Read. */
+#define VIRTIO_BLK_T_OUT 1              /**< Write. */
+#define VIRTIO_BLK_S_OK 0               /**< Success. */
+
+/** Maximum number of virtio disks. */
+#define MAX_DISKS 4
+
+/** Maximum number of requests outstanding at once on a disk.
+   Each takes three descriptors. */
+#define MAX_SLOTS 32
+
+/** One buffer in a virtqueue. */
+struct vring_desc
+  {
+    uint64_t addr;              /**< Physical address. */
+    uint32_t len;               /**< Length in bytes. */
+    uint16_t flags;             /**< DESC_* flags. */
+    uint16_t next;              /**< Next descriptor in chain. */
+  }
+PACKED;
+
+/** Ring of descriptor chains that the driver offers the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /**< Incremented per chain offered. */
+    uint16_t ring[];            /**< Head descriptor of each chain. */
+  }
+PACKED;
+
+/** A descriptor chain that the device has finished with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /**< Head descriptor of the chain. */
+    uint32_t len;               /**< Bytes written into the chain. */
+  }
+PACKED;
+
+/** Ring of chains that the device hands back to the driver. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /**< Incremented per chain returned. */
+    struct vring_used_elem ring[];
+  }
+PACKED;
+
+/** Header that begins each block request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /**< VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /**< First sector. */
+  }
+PACKED;
+
+/** A request in flight.  Slot I uses descriptors 3*I, 3*I + 1 and
+   3*I + 2 for its header, data and status. */
+struct slot
+  {
+    struct virtio_blk_header header;    /**< Read by device. */
+    uint8_t status;                     /**< Written by device. */
+    struct block_request *request;      /**< The block request. */
+  };
+
+/** A virtio disk. */
+struct virtio_disk
+  {
+    char name[8];               /**< Name, e.g. "vda". */
+    uint16_t io_base;           /**< Base of legacy registers. */
+    uint8_t irq;                /**< Interrupt vector. */
+
+    uint16_t queue_size;        /**< Entries in each ring. */
+    struct vring_desc *desc;    /**< Descriptor table. */
+    struct vring_avail *avail;  /**< Available ring. */
+    volatile struct vring_used *used;   /**< Used ring. */
+    uint16_t last_used;         /**< Used ring entries consumed so far. */
+
+    struct lock lock;           /**< Protects rings and slots. */
+    struct slot *slots;         /**< Requests in flight. */
+    size_t slot_cnt;            /**< Number of slots. */
+    struct bitmap *free_slots;  /**< True bits are free slots. */
+    struct condition slot_free; /**< Signaled when a slot frees up. */
+    struct semaphore completion_wait;   /**< Up'd by interrupt handler. */
+  };
+
+static struct virtio_disk disks[MAX_DISKS];
+static size_t disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static void init_disk (struct virtio_disk *, const struct pci_dev *);
+static thread_func completion_thread;
+static void interrupt_handler (struct intr_frame *);
+
+/** Finds and registers each virtio block device, naming them
+   vda, vdb, and so on. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev dev;
+  int idx;
+
+  for (idx = 0; disk_cnt < MAX_DISKS
+         && pci_find_id (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, idx, &dev);
+       idx++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      init_disk (d, &dev);
+    }
+}
+
+/** Sets up virtio disk D, which is PCI function DEV and the
+   next unused element of disks[], and registers it as a block
+   device.  Leaves D out of disk_cnt if it cannot be used. */
+static void
+init_disk (struct virtio_disk *d, const struct pci_dev *dev)
+{
+  size_t avail_size, used_ofs, used_size, i;
+  uint32_t capacity_lo, capacity_hi;
+  block_sector_t capacity;
+  struct block *block;
+  uint8_t *vring, irq_line;
+  size_t j;
+
+  d->io_base = pci_get_bar (dev, 0);
+  irq_line = pci_read_config (dev, PCI_REG_IRQ) & 0xff;
+  d->irq = irq_line + 0x20;
+  if (d->io_base == 0)
+    {
+      printf ("%s: unusable PCI configuration, ignoring\n", d->name);
+      return;
+    }
+
+  /* Line 0xff means no interrupt was assigned, and line 2 is the
+     PIC cascade.  Any other line may be shared with an earlier
+     virtio disk, but not with another driver, such as the
+     timer's, the serial port's, or the IDE channels'. */
+  for (j = 0; j < disk_cnt; j++)
+    if (disks[j].irq == d->irq)
+      break;
+  if (irq_line > 15 || irq_line == 2
+      || (j == disk_cnt && intr_is_registered (d->irq)))
+    {
+      printf ("%s: IRQ line %d unassigned or in use, ignoring\n",
+              d->name, irq_line);
+      return;
+    }
+  pci_enable_master (dev);
+
+  /* Reset, then announce ourselves.  We use none of the optional
+     features. */
+  outb (d->io_base + REG_STATUS, 0);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (d->io_base + REG_DEVICE_FEATURES);
+  outl (d->io_base + REG_GUEST_FEATURES, 0);
+
+  /* Allocate queue 0, laid out as the legacy interface requires:
+     descriptors and available ring, then the used ring starting
+     on a page boundary. */
+  outw (d->io_base + REG_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->io_base + REG_QUEUE_SIZE);
+  if (d->queue_size < 3)
+    {
+      printf ("%s: no request queue, ignoring\n", d->name);
+      return;
+    }
+  avail_size = sizeof (uint16_t) * (3 + d->queue_size);
+  used_ofs = ROUND_UP (d->queue_size * sizeof (struct vring_desc)
+                       + avail_size, PGSIZE);
+  used_size = ROUND_UP (sizeof (uint16_t) * 3
+                        + d->queue_size * sizeof (struct vring_used_elem),
+                        PGSIZE);
+  vring = palloc_get_multiple (PAL_ZERO, (used_ofs + used_size) / PGSIZE);
+  if (vring == NULL)
+    {
+      printf ("%s: out of memory for request queue, ignoring\n", d->name);
+      return;
+    }
+  d->desc = (struct vring_desc *) vring;
+  d->avail = (struct vring_avail *) (vring + d->queue_size
+                                     * sizeof (struct vring_desc));
+  d->used = (struct vring_used *) (vring + used_ofs);
+  d->last_used = 0;
+
+  d->slot_cnt = d->queue_size / 3 < MAX_SLOTS ? d->queue_size / 3 : MAX_SLOTS;
+  d->slots = malloc (d->slot_cnt * sizeof *d->slots);
+  d->free_slots = bitmap_create (d->slot_cnt);
+  if (d->slots == NULL || d->free_slots == NULL)
+    PANIC ("Failed to allocate memory for %s request slots", d->name);
+  bitmap_set_all (d->free_slots, true);
+
+  /* Chain each slot's three descriptors together once; only
+     addresses, lengths and the data direction change later. */
+  for (i = 0; i < d->slot_cnt; i++)
+    {
+      struct vring_desc *desc = &d->desc[i * 3];
+      desc[0].addr = vtop (&d->slots[i].header);
+      desc[0].len = sizeof d->slots[i].header;
+      desc[0].flags = DESC_NEXT;
+      desc[0].next = i * 3 + 1;
+      desc[1].next = i * 3 + 2;
+      desc[2].addr = vtop (&d->slots[i].status);
+      desc[2].len = sizeof d->slots[i].status;
+      desc[2].flags = DESC_WRITE;
+    }
+
+  lock_init (&d->lock);
+  cond_init (&d->slot_free);
+  sema_init (&d->completion_wait, 0);
+
+  /* Several virtio devices may share an interrupt line, so only
+     the first registers the handler. */
+  for (j = 0; j < disk_cnt; j++)
+    if (disks[j].irq == d->irq)
+      break;
+  if (j == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  disk_cnt++;
+
+  outl (d->io_base + REG_QUEUE_PFN, vtop (vring) / PGSIZE);
+  outb (d->io_base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  thread_create (d->name, PRI_DEFAULT, completion_thread, d);
+
+  /* Register.  Pintos sector numbers are 32 bits, so a larger
+     disk is used only in part. */
+  capacity_lo = inl (d->io_base + REG_CAPACITY);
+  capacity_hi = inl (d->io_base + REG_CAPACITY + 4);
+  capacity = capacity_hi != 0 ? UINT32_MAX : capacity_lo;
+  block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                          &virtio_blk_operations, d);
+  partition_scan (block);
+}
+
+/** Offers REQUEST to virtio disk D, waiting first for a free slot
+   if all are in use.  The request completes later, in D's
+   completion thread. */
+static void
+virtio_blk_submit (void *d_, struct block_request *request)
+{
+  struct virtio_disk *d = d_;
+  struct vring_desc *desc;
+  struct slot *s;
+  size_t slot;
+
+  ASSERT (is_kernel_vaddr (request->buffer));
+
+  lock_acquire (&d->lock);
+  while ((slot = bitmap_scan_and_flip (d->free_slots, 0, 1, true))
+         == BITMAP_ERROR)
+    cond_wait (&d->slot_free, &d->lock);
+
+  s = &d->slots[slot];
+  s->header.type = request->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = request->sector;
+  s->status = 0xff;
+  s->request = request;
+
+  /* Kernel virtual memory maps physical memory linearly, so the
+     whole buffer is one physically contiguous descriptor. */
+  desc = &d->desc[slot * 3 + 1];
+  desc->addr = vtop (request->buffer);
+  desc->len = request->cnt * BLOCK_SECTOR_SIZE;
+  desc->flags = DESC_NEXT | (request->write ? 0 : DESC_WRITE);
+
+  /* Publish the chain, then the new index, then tell the device. */
+  d->avail->ring[d->avail->idx % d->queue_size] = slot * 3;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->io_base + REG_QUEUE_NOTIFY, 0);
+  lock_release (&d->lock);
+}
+
+/** Thread that completes the requests virtio disk D_ returns in
+   its used ring, each time the interrupt handler reports that
+   there are some. */
+static void
+completion_thread (void *d_)
+{
+  struct virtio_disk *d = d_;
+
+  for (;;)
+    {
+      struct list done;
+
+      sema_down (&d->completion_wait);
+
+      list_init (&done);
+      lock_acquire (&d->lock);
+      while (d->last_used != d->used->idx)
+        {
+          uint32_t id = d->used->ring[d->last_used % d->queue_size].id;
+          struct slot *s = &d->slots[id / 3];
+          struct block_request *r = s->request;
+
+          barrier ();
+          if (s->status != VIRTIO_BLK_S_OK)
+            PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+                   r->write ? "write" : "read", r->sector);
+          list_push_back (&done, &r->fifo_elem);
+          bitmap_reset (d->free_slots, id / 3);
+          d->last_used++;
+        }
+      cond_broadcast (&d->slot_free, &d->lock);
+      lock_release (&d->lock);
+
+      while (!list_empty (&done))
+        block_complete (list_entry (list_pop_front (&done),
+                                    struct block_request, fifo_elem));
+    }
+}
+
+/** Reads sector SEC_NO from virtio disk D into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_blk_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  struct block_request request;
+
+  block_request_init (&request, false, sec_no, 1, buffer, NULL, NULL);
+  virtio_blk_submit (d, &request);
+  block_wait (&request);
+}
+
+/** Write sector SEC_NO to virtio disk D from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+virtio_blk_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  struct block_request request;
+
+  block_request_init (&request, true, sec_no, 1, (void *) buffer,
+                      NULL, NULL);
+  virtio_blk_submit (d, &request);
+  block_wait (&request);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    NULL,
+    NULL,
+    virtio_blk_submit
+  };
+
+/** Virtio disk interrupt handler.  Reading a disk's interrupt
+   status register acknowledges its interrupt. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+      if (f->vec_no == d->irq
+          && (inb (d->io_base + REG_ISR) & ISR_QUEUE) != 0)
+        sema_up (&d->completion_wait);
+    }
+}
@@ -8,10 +8,26 @@
 #include "devices/timer.h"
 
 #define NUM_SECTORS 128 /* Number of sectors in the buffer cache */
+#define NUM_WRITEBACKS 8 /* Evicted blocks that may be on their way to disk */
+
+/* A dirty block written back on eviction. The write is submitted without
+   waiting for it, so the disk works on it while the cache goes on, and
+   the block's data stays here until it has landed */
+struct writeback {
+    bool pending;                   /* write submitted, not yet reaped */
+    block_sector_t sector;          /* sector being written */
+    struct block_request request;   /* the write */
+    uint8_t buf[BLOCK_SECTOR_SIZE]; /* copy of the evicted block */
+};
+static struct writeback writebacks[NUM_WRITEBACKS];
+static int writeback_next; /* slot to wait for when all are pending */
 
 /* function prototypes */
 static void buffer_cache_flush(struct buffer_block *entry);
-static struct buffer_block* buffer_cache_evict(void);
+static struct buffer_block* buffer_cache_evict(struct buffer_block *keep);
+static void buffer_cache_fill(block_sector_t sector, void *buf);
+static struct writeback *writeback_find(block_sector_t sector);
+static void writeback_wait(struct writeback *wb);
 
 /* Initialize cache_list and allocate memory for buffer cache entries */
 void buffer_cache_init(void) {
@@ -56,8 +72,9 @@ struct buffer_block *buffer_cache_find(block_sector_t sector) {
     return NULL; // Cache miss
 }
 
-/* Helper function to evict the least recently used block from the cache */
-static struct buffer_block* buffer_cache_evict(void) {
+/* Helper function to evict the least recently used block from the cache,
+   never choosing keep, which may be NULL */
+static struct buffer_block* buffer_cache_evict(struct buffer_block *keep) {
     //ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
     // Grab the first buffered block element in the list 
     struct list_elem *e = list_begin(&cache_list);
@@ -65,7 +82,7 @@ static struct buffer_block* buffer_cache_evict(void) {
     // Try to find an unused block to evict
     while (true) {
         // If the block is unused, it's a candidate for eviction
-        if (!evict_entry->used) {
+        if (!evict_entry->used && evict_entry != keep) {
             if (evict_entry->dirty) {
                 buffer_cache_flush(evict_entry);
             }
@@ -87,16 +104,29 @@ static struct buffer_block* buffer_cache_evict(void) {
 
 /* Close the buffer cache, flushing all dirty entries to disk. this is a write-back method */
 void buffer_cache_close(void) {
-    // For loop writing all used sectors back to the disk
-    //printf("(buffer_cache_close) starting flushing to disk\n");
+    // Submit a write for every dirty block at once so the disk queue can
+    // sort and merge them, then wait for them all to finish
+    static struct block_request requests[NUM_SECTORS];
     struct list_elem *e;
+    int cnt = 0;
+    lock_acquire(&buffer_cache_lock);
+    // Earlier write-backs land first, so none can overwrite newer data
+    for (int i = 0; i < NUM_WRITEBACKS; i++) {
+        writeback_wait(&writebacks[i]);
+    }
     for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)) {
         struct buffer_block *entry = list_entry(e, struct buffer_block, elem);
-        if (entry->sector != (block_sector_t)-1) {
-            buffer_cache_flush(entry);
+        if (entry->sector != (block_sector_t)-1 && entry->dirty) {
+            block_request_init(&requests[cnt], true, entry->sector, 1, entry->buf, NULL, NULL);
+            block_submit(fs_device, &requests[cnt]);
+            entry->dirty = 0;
+            cnt++;
         }
     }
-    //printf("(buffer_cache_close) finished flushing to disk\n");
+    for (int i = 0; i < cnt; i++) {
+        block_wait(&requests[i]);
+    }
+    lock_release(&buffer_cache_lock);
 }
 //-------------------------------------------------//
 /* buffer cache: block operation functions          */
@@ -111,10 +141,10 @@ void buffer_cache_read(block_sector_t sector, void *target, int sector_ofs, int
     if (entry == NULL) {
         // Cache miss: the block was not found so we need to evict based on LRU
         //printf("   (buffer_cache_read) cache miss\n");
-        entry = buffer_cache_evict();
+        entry = buffer_cache_evict(NULL);
         ASSERT(entry != NULL);
         // Initialize the buffer cache block
-        block_read(fs_device, sector, entry->buf);
+        buffer_cache_fill(sector, entry->buf);
         entry->sector = sector;
         entry->dirty = 0;
     } 
@@ -136,12 +166,12 @@ void buffer_cache_write(block_sector_t sector, const void *source, int sector_of
     if (entry == NULL) {
         // Cache miss: need eviction
         //printf("    (buffer_cache_write) cache miss\n");
-        entry = buffer_cache_evict();  // Evict a cache block if necessary.
+        entry = buffer_cache_evict(NULL);  // Evict a cache block if necessary.
         ASSERT(entry != NULL);
 
         // Read the sector data into the cache block only if necessary.
         if (!entry->used || entry->sector != sector) {
-            block_read(fs_device, sector, entry->buf);  // Load the sector data into the cache.
+            buffer_cache_fill(sector, entry->buf);  // Load the sector data into the cache.
             entry->sector = sector;
             entry->dirty = 0;  // Initially not dirty because we just loaded it.
         }
@@ -158,12 +188,99 @@ void buffer_cache_write(block_sector_t sector, const void *source, int sector_of
     lock_release(&buffer_cache_lock);  // Release the lock after the operation.
 }
 
-/* Flush all dirty blocks to disk */
+/* Copy chunk_size bytes from offset src_ofs in sector src to offset dst_ofs
+   in sector dst, directly between the two cache blocks. A destination that
+   is entirely overwritten is not read from disk first */
+void buffer_cache_copy(block_sector_t dst, int dst_ofs, block_sector_t src, int src_ofs, int chunk_size) {
+    lock_acquire(&buffer_cache_lock);
+    struct buffer_block *src_entry = buffer_cache_find(src);
+    if (src_entry == NULL) {
+        src_entry = buffer_cache_evict(NULL);
+        buffer_cache_fill(src, src_entry->buf);
+        src_entry->sector = src;
+        src_entry->dirty = 0;
+    }
+    src_entry->used = 1;
+    src_entry->accessed = 1;
+
+    // Make room for the destination without evicting the source
+    struct buffer_block *dst_entry = buffer_cache_find(dst);
+    if (dst_entry == NULL) {
+        dst_entry = buffer_cache_evict(src_entry);
+        if (chunk_size < BLOCK_SECTOR_SIZE) {
+            buffer_cache_fill(dst, dst_entry->buf);
+        }
+        dst_entry->sector = dst;
+    }
+    dst_entry->used = 1;
+    dst_entry->accessed = 1;
+    dst_entry->dirty = 1;
+
+    // memmove, since the two ranges may be in the same sector
+    memmove(dst_entry->buf + dst_ofs, src_entry->buf + src_ofs, chunk_size);
+    lock_release(&buffer_cache_lock);
+}
+
+/* Write a dirty block back to disk on eviction, without waiting for the
+   write to finish. A write-back slot is reused once its write is done,
+   waiting for the oldest one if every slot is busy */
 static void buffer_cache_flush(struct buffer_block *entry) {
     //ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
-    if (entry->dirty) {
-        block_write(fs_device, entry->sector, entry->buf);
-        entry->dirty = 0;
+    if (!entry->dirty) {
+        return;
+    }
+
+    // A write of the same sector still in flight must land first
+    struct writeback *wb = writeback_find(entry->sector);
+    if (wb == NULL) {
+        for (int i = 0; i < NUM_WRITEBACKS && wb == NULL; i++) {
+            if (!writebacks[i].pending || sema_try_down(&writebacks[i].request.done)) {
+                writebacks[i].pending = false;
+                wb = &writebacks[i];
+            }
+        }
+    }
+    if (wb == NULL) {
+        wb = &writebacks[writeback_next];
+        writeback_next = (writeback_next + 1) % NUM_WRITEBACKS;
+    }
+    writeback_wait(wb);
+
+    memcpy(wb->buf, entry->buf, BLOCK_SECTOR_SIZE);
+    wb->sector = entry->sector;
+    block_request_init(&wb->request, true, wb->sector, 1, wb->buf, NULL, NULL);
+    block_submit(fs_device, &wb->request);
+    wb->pending = true;
+    entry->dirty = 0;
+}
+
+/* Read sector into buf for a cache miss. A sector evicted so recently
+   that its write-back may not have landed is copied from the write-back
+   instead, since the disk may still hold older data */
+static void buffer_cache_fill(block_sector_t sector, void *buf) {
+    struct writeback *wb = writeback_find(sector);
+    if (wb != NULL) {
+        memcpy(buf, wb->buf, BLOCK_SECTOR_SIZE);
+    } else {
+        block_read(fs_device, sector, buf);
+    }
+}
+
+/* Returns the pending write-back of sector, or NULL if there is none */
+static struct writeback *writeback_find(block_sector_t sector) {
+    for (int i = 0; i < NUM_WRITEBACKS; i++) {
+        if (writebacks[i].pending && writebacks[i].sector == sector) {
+            return &writebacks[i];
+        }
+    }
+    return NULL;
+}
+
+/* Wait for wb's write, if any, to finish, and free the slot */
+static void writeback_wait(struct writeback *wb) {
+    if (wb->pending) {
+        block_wait(&wb->request);
+        wb->pending = false;
     }
 }
 
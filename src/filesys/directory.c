@@ -3,6 +3,7 @@
 #include <string.h>
 #include <list.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
@@ -63,6 +64,8 @@ dir_create (block_sector_t sector, size_t entry_cnt)
     // Close the directory
     dir_close(dir);
 
+    // The sectors allocated for the directory go out with it
+    free_map_flush();
     buffer_cache_close();
 
     return true;  // Return true if directory creation and entries creation were successful
@@ -155,7 +158,9 @@ lookup (const struct dir *dir, const char *name,
 /** Searches DIR for a file with the given NAME
     and returns true if one exists, false otherwise.
     On success, sets *INODE to an inode for the file, otherwise to
-    a null pointer.  The caller must close *INODE. */
+    a null pointer.  The caller must close *INODE.
+    Only DIR's lock is held, and it is released before returning,
+    so walking a path never holds two directory locks at once. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
@@ -165,11 +170,13 @@ dir_lookup (const struct dir *dir, const char *name,
     ASSERT (dir != NULL);
     ASSERT (name != NULL);
 
+    inode_lock_dir(dir->inode);
     if (lookup(dir, name, &e, NULL)){
         *inode = inode_open(e.inode_sector);
     } else {
         *inode = NULL;
     }
+    inode_unlock_dir(dir->inode);
 
     return *inode != NULL;
 }
@@ -177,8 +184,9 @@ dir_lookup (const struct dir *dir, const char *name,
 /** Adds a file or directory named NAME to DIR, which must not already contain a
     file or directory by that name. The file's inode is in sector
     INODE_SECTOR. Returns true if successful, false on failure.
-    Fails if NAME is invalid (i.e. too long) or a disk or memory
-    error occurs. */
+    Fails if NAME is invalid (i.e. too long), DIR has been removed,
+    or a disk or memory error occurs.  A new directory's "." and
+    ".." entries are written before NAME becomes visible in DIR. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_dir)
 {
@@ -195,28 +203,18 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_
         return false;
     }
 
-    /* Check that NAME is not in use. */
-    if (lookup(dir, name, NULL, NULL)) {
-        debug_printf("(dir_add) Name already in use: %s\n", name);
-        goto done;
-    }
+    inode_lock_dir(dir->inode);
 
-    /* Set OFS to offset of free slot.
-       If there are no free slots, then it will be set to the
-       current end-of-file. */
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-         ofs += sizeof e) 
-    {
-        if (!e.in_use)
-            break;
+    /* A directory that was removed while we looked up its path
+       must stay empty. */
+    if (inode_is_removed(dir->inode)) {
+        debug_printf("(dir_add) Directory removed: %s\n", name);
+        goto done;
     }
 
-    /* Write slot. */
-    e.in_use = true;
-    strlcpy(e.name, name, sizeof e.name);
-    e.inode_sector = inode_sector;
-    if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e) {
-        debug_printf("(dir_add) Failed to write directory entry\n");
+    /* Check that NAME is not in use. */
+    if (lookup(dir, name, NULL, NULL)) {
+        debug_printf("(dir_add) Name already in use: %s\n", name);
         goto done;
     }
 
@@ -252,9 +250,29 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_
         dir_close(sub_dir);
     }
 
+    /* Set OFS to offset of free slot.
+       If there are no free slots, then it will be set to the
+       current end-of-file. */
+    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+         ofs += sizeof e) 
+    {
+        if (!e.in_use)
+            break;
+    }
+
+    /* Write slot. */
+    e.in_use = true;
+    strlcpy(e.name, name, sizeof e.name);
+    e.inode_sector = inode_sector;
+    if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e) {
+        debug_printf("(dir_add) Failed to write directory entry\n");
+        goto done;
+    }
+
     success = true;
 
 done:
+    inode_unlock_dir(dir->inode);
     if (!success) {
         debug_printf("(dir_add) Failed to add entry: %s\n", name);
     }
@@ -282,7 +300,11 @@ dir_is_empty (struct dir *dir)
 }
 /** Removes any entry for NAME in DIR.
     Returns true if successful, false on failure,
-    which occurs only if there is no file with the given NAME. */
+    which occurs if there is no file with the given NAME, NAME is
+    "." or "..", or NAME is a directory that is not empty.
+    DIR's lock is held throughout, and a directory being removed
+    is locked after it, so that nothing is added to it in between
+    checking that it is empty and marking it removed. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
@@ -294,42 +316,56 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);  // Ensure the directory is not NULL
   ASSERT (name != NULL);  // Ensure the name is not NULL
 
+  // "." and ".." would lock DIR or its parent after DIR itself
+  if (!strcmp(name, ".") || !strcmp(name, "..")) {
+    return false;
+  }
+
+  inode_lock_dir(dir->inode);
+
   // Lookup the directory entry by name and get its offset
   if (!lookup(dir, name, &e, &ofs)){
-    return false;
+    goto done;
   }
 
   // Open the inode corresponding to the directory entry
   inode = inode_open(e.inode_sector);
   if (inode == NULL)
-    return false;
-
-  // Ensure the directory is empty before removal
-  if (inode_is_dir(inode)) {
-    struct dir *sub_dir = dir_open(inode);  // Open the directory to check its contents
-    if (!dir_is_empty(sub_dir)) {
-      dir_close(sub_dir);
+    goto done;
+
+  // Ensure the directory is empty before removal, and keep it
+  // locked until it is marked removed
+  bool is_dir = inode_is_dir(inode);
+  if (is_dir) {
+    struct dir sub_dir = { .inode = inode, .pos = 0 };
+    inode_lock_dir(inode);
+    if (!dir_is_empty(&sub_dir)) {
+      inode_unlock_dir(inode);
       inode_close(inode);
-      return false;  // Return false if the directory is not empty
+      goto done;  // Return false if the directory is not empty
     }
-    dir_close(sub_dir);
   }
 
   // Mark the directory entry as not in use
   e.in_use = false;
-  if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e) {
-    inode_close(inode);
-    return false;
+  if (inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e) {
+    // Mark the inode as removed
+    inode_remove(inode);
+    success = true;
   }
 
-  // Mark the inode as removed
-  inode_remove(inode);
-  success = true;
+  if (is_dir) {
+    inode_unlock_dir(inode);
+  }
 
   // Close the inode
   inode_close(inode);
 
+done:
+  inode_unlock_dir(dir->inode);
+
   if (success) {
+    free_map_flush(); // The free map must not lag the inode and directory
     buffer_cache_close(); // Ensure buffer cache is flushed to disk //change
   }
 
@@ -346,13 +382,17 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
     struct dir_entry e;
+    bool found = false;
 
+  inode_lock_dir(dir->inode);
   while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
     dir->pos += sizeof e;
     if (e.in_use && strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0) {
       strlcpy(name, e.name, NAME_MAX + 1);
-      return true;
+      found = true;
+      break;
     }
   }
-  return false;
+  inode_unlock_dir(dir->inode);
+  return found;
 }
\ No newline at end of file
@@ -113,6 +113,25 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/** Copies SIZE bytes from SRC into DST, starting at each file's
+   current position, without passing the data through a caller's
+   buffer.  Returns the number of bytes actually copied, which may
+   be less than SIZE if end of SRC is reached, or -1 if DST and SRC
+   share an inode and the ranges overlap.  Advances both files'
+   positions by the number of bytes copied. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size) 
+{
+  off_t bytes_copied = inode_copy_at (dst->inode, dst->pos,
+                                      src->inode, src->pos, size);
+  if (bytes_copied > 0)
+    {
+      dst->pos += bytes_copied;
+      src->pos += bytes_copied;
+    }
+  return bytes_copied;
+}
+
 /** Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
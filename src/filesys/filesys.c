@@ -45,9 +45,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-  /* Flush all dirty blocks to disk */
-  void buffer_cache_close();
+  /* Write back the free map, then flush all dirty blocks to disk */
   free_map_close ();
+  buffer_cache_close ();
 }
 /** Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
@@ -68,8 +68,18 @@ filesys_create (const char *name, off_t initial_size, int is_dir)
   }
 
   struct dir *dir = dir_open_path(dir_name);
+
+  // place the new inode near its parent directory, or for a new
+  // directory, at the start of the emptiest allocation group
+  block_sector_t hint = 0;
+  if (dir != NULL) {
+    hint = inode_get_inumber(dir_get_inode(dir));
+    if (is_dir)
+      hint = free_map_group_hint(hint);
+  }
+
   bool success = (dir != NULL
-                  && free_map_allocate(1, &inode_sector)
+                  && free_map_allocate_near(1, hint, &inode_sector)
                   && inode_create(inode_sector, initial_size, is_dir)
                   && dir_add(dir, base_name, inode_sector, is_dir));
   
@@ -91,6 +101,16 @@ filesys_create (const char *name, off_t initial_size, int is_dir)
    or if an internal memory allocation fails. */
 struct file *
 filesys_open (const char *name)
+{
+  return filesys_open_at (thread_current ()->cwd, name);
+}
+
+/** Opens the file with the given NAME, resolving a relative NAME
+   against CWD, or against the root if CWD is null, rather than
+   against the running thread's working directory.  Otherwise the
+   same as filesys_open(). */
+struct file *
+filesys_open_at (struct dir *cwd, const char *name)
 {
   char *dir_name = malloc(strlen(name) + 1);
   char *base_name = malloc(strlen(name) + 1);
@@ -101,7 +121,7 @@ filesys_open (const char *name)
     return NULL;
   }
 
-  struct dir *dir = dir_open_path(dir_name);
+  struct dir *dir = dir_open_path_at(cwd, dir_name);
   struct inode *inode = NULL;
 
   if (dir != NULL) {
@@ -142,6 +162,7 @@ filesys_remove (const char *name)
   free(dir_name);
   free(base_name);
   if (success) {
+    free_map_flush(); // The free map must not lag the inode and directory
     buffer_cache_close(); // Ensure buffer cache is flushed to disk //change
   }
   
@@ -185,15 +206,22 @@ split_path (const char *path, char *dir, char *base)
 }
 
 
-/* Opens the directory for the given path */
+/* Opens the directory for the given path. Each directory's lock is held
+   only while looking up the next component in it, so concurrent walks
+   never wait on one another in an inconsistent order */
 struct dir *dir_open_path(const char *path) {
+  return dir_open_path_at(thread_current()->cwd, path);
+}
+
+/* Opens the directory for the given path, resolving a relative path
+   against CWD, or against the root if CWD is null */
+struct dir *dir_open_path_at(struct dir *cwd, const char *path) {
   // Copy of path to tokenize
   char s[strlen(path) + 1];
   strlcpy(s, path, sizeof(s));
 
   // Determine starting directory based on whether the path is absolute or relative
-  struct dir *curr = (path[0] == '/') ? dir_open_root() : 
-                     (thread_current()->cwd ? dir_reopen(thread_current()->cwd) : dir_open_root());
+  struct dir *curr = (path[0] == '/' || cwd == NULL) ? dir_open_root() : dir_reopen(cwd);
   
   if (curr == NULL) return NULL;
 
@@ -207,6 +235,13 @@ struct dir *dir_open_path(const char *path) {
       dir_close(curr);
       return NULL;
     }
+
+    // Only a directory can be walked into and locked
+    if (!inode_is_dir(inode)) {
+      inode_close(inode);
+      dir_close(curr);
+      return NULL;
+    }
     
     struct dir *next = dir_open(inode);
     if (next == NULL) { 
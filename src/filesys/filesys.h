@@ -17,10 +17,12 @@ void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size, int is_dir); 
 struct file *filesys_open (const char *name);
+struct file *filesys_open_at (struct dir *cwd, const char *name);
 bool filesys_remove (const char *name);
 
 // directory helper functions
 bool split_path (const char *path, char *dir, char *base);
 struct dir *dir_open_path (const char *path);
+struct dir *dir_open_path_at (struct dir *cwd, const char *path);
 static bool get_next_part (char part[NAME_MAX + 1], const char **srcp);
 #endif /**< filesys/filesys.h */
@@ -1,13 +1,41 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/** Number of free map bits held by one sector of the free map
+   file. */
+#define FREE_MAP_SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/** Number of sectors in an allocation group.  The disk is divided
+   into groups of this many sectors, and allocations try to stay
+   in the group of the sector they are related to. */
+#define FREE_MAP_GROUP_SECTORS 1024
 
 static struct file *free_map_file;   /**< Free map file. */
 static struct bitmap *free_map;      /**< Free map, one bit per sector. */
 
+/** Sectors of the free map file whose bits changed since they
+   were last written, one bit per free map file sector. */
+static struct bitmap *free_map_dirty;
+
+static size_t group_cnt;             /**< Number of allocation groups. */
+static size_t *group_free;           /**< Free sectors in each group. */
+
+/** Protects the free map, its dirty bits, and the group counts.
+   Held on its own, so allocation never waits on a directory. */
+static struct lock free_map_lock;
+
+static void mark_dirty (block_sector_t sector, size_t cnt);
+static void account (block_sector_t sector, size_t cnt, bool allocated);
+static void count_groups (void);
+static size_t scan_group (size_t group, block_sector_t start, size_t cnt);
+
 /** Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,38 +43,145 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  bitmap_enable_summary (free_map);   /* Only a speedup if it fails. */
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                                FREE_MAP_SECTOR_BITS));
+  if (free_map_dirty == NULL)
+    PANIC ("free map dirty bitmap creation failed");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), FREE_MAP_GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("free map group creation failed");
+  count_groups ();
+  lock_init (&free_map_lock);
 }
 
 /** Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+   The change reaches the free map file at the next
+   free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/** Like free_map_allocate(), but places the CNT sectors as close
+   after HINT as it can.  The allocation group that contains HINT
+   is tried first, from HINT onward, then from its beginning.
+   Then each following group that has at least CNT free sectors
+   is tried, wrapping around the disk. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t hint,
+                        block_sector_t *sectorp)
+{
+  size_t sector = BITMAP_ERROR;
+  size_t first, i;
+
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  first = hint / FREE_MAP_GROUP_SECTORS;
+
+  lock_acquire (&free_map_lock);
+
+  for (i = 0; i < group_cnt && sector == BITMAP_ERROR; i++)
+    {
+      size_t group = (first + i) % group_cnt;
+      if (group_free[group] < cnt)
+        continue;
+      if (i == 0)
+        sector = scan_group (group, hint, cnt);
+      if (sector == BITMAP_ERROR)
+        sector = scan_group (group, group * FREE_MAP_GROUP_SECTORS, cnt);
+    }
+
+  /* A run of CNT free sectors may straddle groups that are each
+     too full on their own. */
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector == BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      lock_release (&free_map_lock);
+      return false;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  account (sector, cnt, true);
+  lock_release (&free_map_lock);
+  *sectorp = sector;
+  return true;
+}
+
+/** Returns the sector at which to start allocating for a new
+   directory whose parent directory's inode is at PARENT.
+   This is the first sector of the allocation group with the
+   most free sectors, so that directories spread across the disk
+   and leave room near themselves for the files they will hold.
+   PARENT's own group wins ties. */
+block_sector_t
+free_map_group_hint (block_sector_t parent)
+{
+  size_t best, i;
+
+  if (parent >= bitmap_size (free_map))
+    parent = 0;
+  best = parent / FREE_MAP_GROUP_SECTORS;
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < group_cnt; i++)
+    if (group_free[i] > group_free[best])
+      best = i;
+  lock_release (&free_map_lock);
+  return best == parent / FREE_MAP_GROUP_SECTORS
+         ? parent : best * FREE_MAP_GROUP_SECTORS;
 }
 
 /** Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  account (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/** Writes every dirty part of the free map to the free map file.
+   Runs of adjacent dirty sectors are written with a single
+   file_write_at() call, so they land in the buffer cache
+   together. */
+void
+free_map_flush (void)
+{
+  size_t start = 0;
+
+  if (free_map_file == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  while ((start = bitmap_scan (free_map_dirty, start, 1, true))
+         != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (free_map_dirty, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map_dirty);
+
+      if (!bitmap_write_range (free_map, free_map_file,
+                               start * FREE_MAP_SECTOR_BITS,
+                               (end - start) * FREE_MAP_SECTOR_BITS))
+        PANIC ("can't write free map");
+      bitmap_set_multiple (free_map_dirty, start, end - start, false);
+      start = end;
+    }
+  lock_release (&free_map_lock);
 }
 
 /** Opens the free map file and reads it from disk. */
@@ -58,13 +193,17 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+  count_groups ();
 }
 
 /** Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /** Creates a new free map file on disk and writes the free map to
@@ -82,4 +221,68 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
+}
+
+/** Records that the free map file sectors holding the bits for
+   the CNT sectors starting at SECTOR must be rewritten. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first, last;
+
+  if (cnt == 0)
+    return;
+
+  first = sector / FREE_MAP_SECTOR_BITS;
+  last = (sector + cnt - 1) / FREE_MAP_SECTOR_BITS;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/** Adjusts the per-group free counts for the CNT sectors starting
+   at SECTOR, which have just been ALLOCATED or released. */
+static void
+account (block_sector_t sector, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      size_t group = sector / FREE_MAP_GROUP_SECTORS;
+      size_t group_end = (group + 1) * FREE_MAP_GROUP_SECTORS;
+      size_t n = group_end - sector < cnt ? group_end - sector : cnt;
+
+      if (allocated)
+        group_free[group] -= n;
+      else
+        group_free[group] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/** Recomputes every group's free count from the free map. */
+static void
+count_groups (void)
+{
+  size_t i;
+
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t start = i * FREE_MAP_GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+      if (cnt > FREE_MAP_GROUP_SECTORS)
+        cnt = FREE_MAP_GROUP_SECTORS;
+      group_free[i] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/** Returns the first sector of a run of CNT free sectors that
+   begins in GROUP at or after START, or BITMAP_ERROR if there is
+   none. */
+static size_t
+scan_group (size_t group, block_sector_t start, size_t cnt)
+{
+  size_t sector = bitmap_scan (free_map, start, cnt, false);
+  if (sector != BITMAP_ERROR && sector / FREE_MAP_GROUP_SECTORS != group)
+    sector = BITMAP_ERROR;
+  return sector;
 }
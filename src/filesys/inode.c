@@ -8,6 +8,7 @@
 #include "threads/malloc.h"
 #include "filesys/cache.h"
 #include "threads/interrupt.h"
+#include "threads/synch.h"
 
 //#define debug_printf(fmt, ...) printf(fmt, ##__VA_ARGS__)
 #define debug_printf(fmt, ...) // Define as empty if debugging is disabled
@@ -48,6 +49,7 @@ struct inode
     int open_cnt;                       /**< Number of openers. */
     bool removed;                       /**< True if deleted, false otherwise. */
     int deny_write_cnt;                 /**< 0: writes ok, >0: deny writes. */
+    struct lock dir_lock;               /**< Guards a directory's entries. */
     struct inode_disk data;             /**< Inode content. */
 
   
@@ -110,20 +112,38 @@ byte_to_sector (const struct inode *inode, off_t pos)
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/** Protects open_inodes and every open inode's open_cnt. */
+static struct lock open_inodes_lock;
+
 /** Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
 }
 
 
-/** Allocates the blocks for the inode based on the length **/
-static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
+/* Allocates one sector as close after *HINT as possible and moves
+   *HINT to it, so that consecutive blocks of a file end up next to
+   each other and next to the file's inode. */
+static bool allocate_near(block_sector_t *hint, block_sector_t *sectorp) {
+  if (!free_map_allocate_near(1, *hint, sectorp)) {
+    return false;
+  }
+  *hint = *sectorp;
+  return true;
+}
+
+/** Allocates the blocks for the inode based on the length.
+    New blocks are placed near SECTOR, the inode's own sector. **/
+static bool inode_allocate(struct inode_disk *disk_inode, block_sector_t sector, off_t length) {
   // printf("(inode_allocate) start, length:%u\n", length);
   
   // string of zeros
   static char zero[BLOCK_SECTOR_SIZE];
+  // where the next block should go
+  block_sector_t hint = sector;
 
   // get how many sectors the write will take
   size_t sector_ct = bytes_to_sectors(length);
@@ -157,7 +177,7 @@ static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
     if (disk_inode->direct_blocks[i] == 0) {
       // write to the "1" free direct block
       // printf("(inode_allocate) attempting direct allocation (index %d)!\n", i);
-      if (!free_map_allocate(1, &disk_inode->direct_blocks[i])) {
+      if (!allocate_near(&hint, &disk_inode->direct_blocks[i])) {
         // failed to allocate
         return false;
       }
@@ -170,7 +190,7 @@ static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
   if (indirect_ct > 0) {
     block_sector_t indirect_blocks[INDIRECT_COUNT];
     if (disk_inode->indirect_block == 0) {
-      if (!free_map_allocate(1, &disk_inode->indirect_block)) {
+      if (!allocate_near(&hint, &disk_inode->indirect_block)) {
         return false;
       }
       buffer_cache_write(disk_inode->indirect_block, zero, 0, BLOCK_SECTOR_SIZE);
@@ -179,7 +199,7 @@ static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
     buffer_cache_read(disk_inode->indirect_block, indirect_blocks, 0, BLOCK_SECTOR_SIZE);
     for (size_t i = 0; i < indirect_ct; i++) {
       if (indirect_blocks[i] == 0) {
-        if (!free_map_allocate(1, &indirect_blocks[i])) {
+        if (!allocate_near(&hint, &indirect_blocks[i])) {
           return false;
         }
         buffer_cache_write(indirect_blocks[i], zero, 0, BLOCK_SECTOR_SIZE);
@@ -192,7 +212,7 @@ static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
   if (dbl_indirect_ct > 0) {
     block_sector_t doubly_indirect_blocks[INDIRECT_COUNT];
     if (disk_inode->double_indirect_block == 0) {
-      if (!free_map_allocate(1, &disk_inode->double_indirect_block)) {
+      if (!allocate_near(&hint, &disk_inode->double_indirect_block)) {
         return false;
       }
       buffer_cache_write(disk_inode->double_indirect_block, zero, 0, BLOCK_SECTOR_SIZE);
@@ -201,7 +221,7 @@ static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
     buffer_cache_read(disk_inode->double_indirect_block, doubly_indirect_blocks, 0, BLOCK_SECTOR_SIZE);
     for (size_t i = 0; i < dbl_indirect_ct; i++) {
       if (doubly_indirect_blocks[i] == 0) {
-        if (!free_map_allocate(1, &doubly_indirect_blocks[i])) {
+        if (!allocate_near(&hint, &doubly_indirect_blocks[i])) {
           return false;
         }
         buffer_cache_write(doubly_indirect_blocks[i], zero, 0, BLOCK_SECTOR_SIZE);
@@ -286,7 +306,7 @@ inode_create (block_sector_t sector, off_t length, int is_dir)
       disk_inode->magic = INODE_MAGIC;
       disk_inode->directory = is_dir;
       // Allocate the blocks for the inode
-      if (inode_allocate(disk_inode, disk_inode->length))
+      if (inode_allocate(disk_inode, sector, disk_inode->length))
         {
           // write to the cache
           buffer_cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
@@ -307,6 +327,8 @@ inode_open (block_sector_t sector)
   struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
@@ -314,7 +336,8 @@ inode_open (block_sector_t sector)
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
@@ -322,17 +345,23 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
+  /* Initialize.  The lock stays held until the data is read, so
+     that no other opener finds the inode half filled in. */
   list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  lock_init (&inode->dir_lock);
 
   // Try to get the inode from the buffer cache
   buffer_cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -341,7 +370,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -363,10 +396,12 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
+      lock_release (&open_inodes_lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
@@ -377,6 +412,8 @@ inode_close (struct inode *inode)
 
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /** Marks INODE to be deleted when it is closed by the last caller who
@@ -446,7 +483,7 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offse
   // extend the file
   off_t new_length = offset + size;
   if (new_length > inode->data.length) {
-    inode_allocate(&inode->data, new_length);
+    inode_allocate(&inode->data, inode->sector, new_length);
     inode->data.length = new_length;
     buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
   }
@@ -491,6 +528,64 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offse
   return bytes_written;
 }
 
+/** Copies SIZE bytes from SRC, starting at SRC_OFS, into DST,
+   starting at DST_OFS, moving data between buffer cache blocks
+   without an intermediate buffer.  If the copy extends DST, all of
+   the new blocks are allocated up front, so that they can be laid
+   out as a single run.  Returns the number of bytes copied, which
+   is less than SIZE if end of SRC is reached, or -1 if DST and SRC
+   are the same inode and the two ranges overlap. */
+off_t
+inode_copy_at (struct inode *dst, off_t dst_ofs,
+               struct inode *src, off_t src_ofs, off_t size)
+{
+  off_t bytes_copied = 0;
+  off_t src_left = inode_length (src) - src_ofs;
+
+  if (dst->deny_write_cnt != 0)
+    return 0;
+  if (size > src_left)
+    size = src_left > 0 ? src_left : 0;
+  if (dst == src && dst_ofs < src_ofs + size && src_ofs < dst_ofs + size)
+    return -1;
+
+  /* Extend the destination once for the whole copy. */
+  if (dst_ofs + size > dst->data.length)
+    {
+      if (!inode_allocate (&dst->data, dst->sector, dst_ofs + size))
+        return 0;
+      dst->data.length = dst_ofs + size;
+      buffer_cache_write (dst->sector, &dst->data, 0, BLOCK_SECTOR_SIZE);
+    }
+
+  while (size > 0)
+    {
+      /* Sectors and offsets within them on both sides. */
+      block_sector_t src_sector = byte_to_sector (src, src_ofs);
+      block_sector_t dst_sector = byte_to_sector (dst, dst_ofs);
+      int src_sector_ofs = src_ofs % BLOCK_SECTOR_SIZE;
+      int dst_sector_ofs = dst_ofs % BLOCK_SECTOR_SIZE;
+
+      /* Bytes left in either sector or in the copy, the least of
+         the three. */
+      int chunk_size = BLOCK_SECTOR_SIZE - src_sector_ofs;
+      if (BLOCK_SECTOR_SIZE - dst_sector_ofs < chunk_size)
+        chunk_size = BLOCK_SECTOR_SIZE - dst_sector_ofs;
+      if (size < chunk_size)
+        chunk_size = size;
+
+      buffer_cache_copy (dst_sector, dst_sector_ofs,
+                         src_sector, src_sector_ofs, chunk_size);
+
+      /* Advance to the next chunk. */
+      size -= chunk_size;
+      src_ofs += chunk_size;
+      dst_ofs += chunk_size;
+      bytes_copied += chunk_size;
+    }
+  return bytes_copied;
+}
+
 /** Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -537,4 +632,21 @@ bool
 inode_is_removed (const struct inode *inode)
 {
   return inode->removed;
+}
+
+/** Acquires the lock on directory INODE's entries.  Directory
+   locks are taken one at a time, except that a parent directory's
+   lock may be held while taking a child's, never the reverse. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  lock_acquire (&inode->dir_lock);
+}
+
+/** Releases the lock on directory INODE's entries. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
 }
\ No newline at end of file
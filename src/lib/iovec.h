@@ -0,0 +1,17 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/** One segment of a scatter/gather transfer, for readv() and
+   writev(). */
+struct iovec
+  {
+    void *iov_base;             /**< Start of segment. */
+    size_t iov_len;             /**< Length of segment in bytes. */
+  };
+
+/** Maximum number of segments in one readv() or writev(). */
+#define IOV_MAX 64
+
+#endif /**< lib/iovec.h */
@@ -23,13 +23,25 @@ typedef unsigned long elem_type;
 
 /** From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap may also carry a summary, enabled with
+   bitmap_enable_summary(), that has one bit per element of BITS
+   in each of FULL and EMPTY.  A FULL bit is set when every bit in
+   the element is true, an EMPTY bit when every bit is false.  The
+   last element is never summarized if it is only partly used.
+   bitmap_scan() uses the summary to step over runs of elements
+   32 at a time. */
 struct bitmap
   {
     size_t bit_cnt;     /**< Number of bits. */
     elem_type *bits;    /**< Elements that represent bits. */
+    elem_type *full;    /**< Elements with all bits true, or null. */
+    elem_type *empty;   /**< Elements with all bits false, or null. */
   };
 
+static void summary_update (struct bitmap *, size_t elem);
+
 /** Returns the index of the element that contains the bit
    numbered BIT_IDX. */
 static inline size_t
@@ -68,6 +80,36 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/** Returns an elem_type with the CNT bits starting at bit OFS
+   turned on.  OFS + CNT must not exceed ELEM_BITS. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt)
+{
+  ASSERT (ofs + cnt <= ELEM_BITS);
+  if (cnt == ELEM_BITS)
+    return (elem_type) -1;
+  return (((elem_type) 1 << cnt) - 1) << ofs;
+}
+
+/** Returns the number of bits set in X.  (GCC's
+   __builtin_popcount would pull in a libgcc helper.) */
+static inline size_t
+count_ones (elem_type x)
+{
+  size_t cnt = 0;
+  for (; x != 0; x &= x - 1)
+    cnt++;
+  return cnt;
+}
+
+/** Returns element IDX of B, inverted if VALUE is false, so that
+   the bits equal to VALUE are the ones turned on. */
+static inline elem_type
+matching_bits (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
 
 /** Creation and destruction. */
 
@@ -82,6 +124,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->full = b->empty = NULL;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -105,6 +148,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = b->empty = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -124,10 +168,43 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL) 
     {
+      free (b->full);
+      free (b->empty);
       free (b->bits);
       free (b);
     }
 }
+
+/** Gives B a summary of which elements are entirely true or
+   entirely false, which lets bitmap_scan() skip over large
+   allocated or free regions quickly.  Returns true if
+   successful, false if memory allocation fails, in which case B
+   works as before, only without the speedup.
+   Not for use on bitmaps created by bitmap_create_in_buf(). */
+bool
+bitmap_enable_summary (struct bitmap *b)
+{
+  size_t summary_size = byte_cnt (elem_cnt (b->bit_cnt));
+  size_t i;
+
+  ASSERT (b != NULL);
+  if (b->full != NULL)
+    return true;
+
+  b->full = calloc (1, summary_size);
+  b->empty = calloc (1, summary_size);
+  if (b->full == NULL || b->empty == NULL)
+    {
+      free (b->full);
+      free (b->empty);
+      b->full = b->empty = NULL;
+      return false;
+    }
+
+  for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+    summary_update (b, i);
+  return true;
+}
 
 /** Bitmap size. */
 
@@ -163,6 +240,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  summary_update (b, idx);
 }
 
 /** Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -176,6 +254,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  summary_update (b, idx);
 }
 
 /** Atomically toggles the bit numbered IDX in B;
@@ -191,6 +270,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  summary_update (b, idx);
 }
 
 /** Returns the value of the bit numbered IDX in B. */
@@ -213,18 +293,32 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/** Sets the CNT bits starting at START in B to VALUE. */
+/** Sets the CNT bits starting at START in B to VALUE.
+   Works one element at a time, and each element is updated
+   atomically, as in bitmap_mark() and bitmap_reset(). */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < cnt ? ELEM_BITS - ofs : cnt;
+      elem_type mask = range_mask (ofs, n);
+
+      if (value)
+        asm ("orl %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "+m" (b->bits[idx]) : "r" (~mask) : "cc");
+      summary_update (b, idx);
+
+      start += n;
+      cnt -= n;
+    }
 }
 
 /** Returns the number of bits in B between START and START + CNT,
@@ -232,16 +326,24 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < cnt ? ELEM_BITS - ofs : cnt;
+
+      value_cnt += count_ones (matching_bits (b, idx, value)
+                               & range_mask (ofs, n));
+      start += n;
+      cnt -= n;
+    }
   return value_cnt;
 }
 
@@ -250,15 +352,21 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < cnt ? ELEM_BITS - ofs : cnt;
+
+      if ((matching_bits (b, idx, value) & range_mask (ofs, n)) != 0)
+        return true;
+      start += n;
+      cnt -= n;
+    }
   return false;
 }
 
@@ -288,23 +396,141 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /** Finding set or unset bits. */
 
+/** Returns the index of the first bit at or after IDX, and before
+   CNT, that is set to VALUE in the summary array SUMMARY, or CNT
+   if there is none. */
+static size_t
+summary_find (const elem_type *summary, size_t idx, size_t cnt, bool value)
+{
+  while (idx < cnt)
+    {
+      elem_type e = value ? summary[elem_idx (idx)] : ~summary[elem_idx (idx)];
+      e >>= idx % ELEM_BITS;
+      if (e != 0)
+        {
+          idx += __builtin_ctzl (e);
+          break;
+        }
+      idx = (elem_idx (idx) + 1) * ELEM_BITS;
+    }
+  return idx < cnt ? idx : cnt;
+}
+
+/** Returns the index of the first element of B at or after IDX
+   that has at least one bit set to VALUE, or the number of
+   elements in B if there is none. */
+static size_t
+skip_elems (const struct bitmap *b, size_t idx, bool value)
+{
+  size_t cnt = elem_cnt (b->bit_cnt);
+
+  if (b->full != NULL)
+    return summary_find (value ? b->empty : b->full, idx, cnt, false);
+
+  while (idx < cnt && matching_bits (b, idx, value) == 0)
+    idx++;
+  return idx;
+}
+
+/** Returns the number of consecutive elements of B starting at
+   IDX whose bits are all set to VALUE, as far as the summary
+   can tell.  Returns 0 if B has no summary. */
+static size_t
+whole_elems (const struct bitmap *b, size_t idx, bool value)
+{
+  if (b->full == NULL)
+    return 0;
+  return summary_find (value ? b->full : b->empty, idx,
+                       elem_cnt (b->bit_cnt), false) - idx;
+}
+
 /** Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works an element at a time: __builtin_ctzl() measures each
+   run of matching bits, so the cost is proportional to the
+   number of elements and runs examined rather than to the
+   number of bits times CNT.  With a summary, whole elements
+   that cannot start a group, and whole elements inside a long
+   group, are passed over 32 at a time. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t i, run;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+
+  /* Bits I - RUN through I - 1 are all set to VALUE. */
+  run = 0;
+  i = start;
+  while (i < b->bit_cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t ofs = i % ELEM_BITS;
+      size_t avail, match;
+      elem_type e;
+
+      if (ofs == 0)
+        {
+          if (run == 0)
+            {
+              /* Nothing to extend: skip elements with no VALUE bits. */
+              i = skip_elems (b, elem_idx (i), value) * ELEM_BITS;
+              if (i >= b->bit_cnt)
+                break;
+            }
+          else
+            {
+              /* Extend the run across elements entirely VALUE. */
+              size_t whole = whole_elems (b, elem_idx (i), value);
+              if (run + whole * ELEM_BITS >= cnt)
+                return i - run;
+              run += whole * ELEM_BITS;
+              i += whole * ELEM_BITS;
+              if (i >= b->bit_cnt)
+                break;
+            }
+        }
+
+      /* Bits I through I + AVAIL - 1 lie in the same element. */
+      avail = ELEM_BITS - ofs;
+      if (avail > b->bit_cnt - i)
+        avail = b->bit_cnt - i;
+      e = matching_bits (b, elem_idx (i), value) >> ofs;
+      if (avail < ELEM_BITS)
+        e &= ((elem_type) 1 << avail) - 1;
+
+      /* Number of bits from I onward that match. */
+      match = ~e != 0 ? (size_t) __builtin_ctzl (~e) : ELEM_BITS;
+      if (run + match >= cnt)
+        return i - run;
+      if (match == avail)
+        {
+          run += match;
+          i += match;
+          continue;
+        }
+
+      /* Bit I + MATCH differs, so start over after it, at the next
+         matching bit in this element if there is one. */
+      run = 0;
+      if (match + 1 == avail)
+        {
+          i += avail;
+          continue;
+        }
+      e >>= match + 1;
+      if (e != 0)
+        i += match + 1 + __builtin_ctzl (e);
+      else
+        i += avail;
     }
   return BITMAP_ERROR;
 }
@@ -344,8 +570,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        summary_update (b, i);
     }
   return success;
 }
@@ -358,8 +588,61 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/** Writes the part of B holding the CNT bits starting at START to
+   FILE, at the same offset that bitmap_write() would put it.
+   Whole elements are written, so slightly more than CNT bits may
+   reach the file.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+
+  if (cnt > b->bit_cnt - start)
+    cnt = b->bit_cnt - start;
+  if (cnt == 0)
+    return true;
+
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /**< FILESYS */
 
+/** Summary maintenance. */
+
+/** Brings the summary bits for element IDX of B up to date, if B
+   has a summary. */
+static void
+summary_update (struct bitmap *b, size_t idx)
+{
+  elem_type mask = bit_mask (idx);
+  bool complete, full, empty;
+
+  if (b->full == NULL)
+    return;
+
+  complete = (idx + 1) * ELEM_BITS <= b->bit_cnt;
+  full = complete && b->bits[idx] == (elem_type) -1;
+  empty = complete && b->bits[idx] == 0;
+
+  if (full)
+    b->full[elem_idx (idx)] |= mask;
+  else
+    b->full[elem_idx (idx)] &= ~mask;
+  if (empty)
+    b->empty[elem_idx (idx)] |= mask;
+  else
+    b->empty[elem_idx (idx)] &= ~mask;
+}
+
 /** Debugging. */
 
 /** Dumps the contents of B to the console as hexadecimal. */
@@ -28,7 +28,18 @@ enum
     SYS_MKDIR,                  /**< Create a directory. */
     SYS_READDIR,                /**< Reads a directory entry. */
     SYS_ISDIR,                  /**< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /**< Returns the inode number for a fd. */
+    SYS_INUMBER,                /**< Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_PREAD,                  /**< Read from a file at an offset. */
+    SYS_PWRITE,                 /**< Write to a file at an offset. */
+    SYS_READV,                  /**< Read from a file into segments. */
+    SYS_WRITEV,                 /**< Write to a file from segments. */
+    SYS_COPY_FILE_RANGE,        /**< Copy between two files. */
+    SYS_URING_SETUP,            /**< Register shared I/O rings. */
+    SYS_URING_ENTER,            /**< Run queued ring operations. */
+
+    SYS_CNT                     /**< Number of system call numbers. */
   };
 
 #endif /**< lib/syscall-nr.h */
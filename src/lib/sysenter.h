@@ -0,0 +1,34 @@
+#ifndef __LIB_SYSENTER_H
+#define __LIB_SYSENTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Returns true if the CPU implements the SYSENTER and SYSEXIT
+   fast system call instructions.  Shared by the kernel, which
+   decides whether to program the SYSENTER MSRs, and the user
+   library, which decides whether to use them, so that the two
+   always agree.
+
+   Early Pentium Pro steppings set the SEP feature flag without
+   supporting the instructions, so they are excluded.  See
+   [IA32-v2b] "SYSENTER". */
+static inline bool
+cpu_has_sysenter (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  unsigned family, model, stepping;
+
+  asm ("cpuid"
+       : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+       : "a" (1));
+  if ((edx & (1u << 11)) == 0)
+    return false;
+
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+  return !(family == 6 && model < 3 && stepping < 3);
+}
+
+#endif /**< lib/sysenter.h */
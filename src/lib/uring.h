@@ -0,0 +1,58 @@
+#ifndef __LIB_URING_H
+#define __LIB_URING_H
+
+/** Shared-memory rings for batched, asynchronous I/O.
+
+   A process sets aside a page-aligned `struct uring' and
+   registers it with uring_setup().  It queues operations by
+   filling in submission entries and advancing SQ_TAIL, then
+   calls uring_enter() to have a kernel worker thread run them
+   while the process goes on computing.  The worker posts one
+   completion entry per operation, in submission order, and
+   advances CQ_TAIL; the process consumes completions by
+   advancing CQ_HEAD.
+
+   Indexes count up without wrapping.  Entry I of either ring is
+   in slot I % URING_ENTRIES. */
+
+/** Number of entries in each ring. */
+#define URING_ENTRIES 64
+
+/** Operations. */
+enum uring_op
+  {
+    URING_OP_OPEN,              /**< Open file named BUF, giving an fd. */
+    URING_OP_CLOSE,             /**< Close FD, giving 0. */
+    URING_OP_READ,              /**< Read LEN bytes from FD into BUF. */
+    URING_OP_WRITE              /**< Write LEN bytes from BUF to FD. */
+  };
+
+/** A submission entry. */
+struct uring_sqe
+  {
+    int op;                     /**< One of enum uring_op. */
+    int fd;                     /**< File descriptor. */
+    void *buf;                  /**< Data buffer or file name. */
+    unsigned len;               /**< Bytes to transfer. */
+    unsigned user_data;         /**< Copied to the completion. */
+  };
+
+/** A completion entry. */
+struct uring_cqe
+  {
+    unsigned user_data;         /**< From the submission. */
+    int result;                 /**< As for the system call, -1 on error. */
+  };
+
+/** The shared rings.  Must fit in, and start on, a page. */
+struct uring
+  {
+    unsigned sq_head;           /**< Next submission to run (kernel). */
+    unsigned sq_tail;           /**< Next free submission slot (process). */
+    unsigned cq_head;           /**< Next completion to consume (process). */
+    unsigned cq_tail;           /**< Next free completion slot (kernel). */
+    struct uring_sqe sqes[URING_ENTRIES];
+    struct uring_cqe cqes[URING_ENTRIES];
+  };
+
+#endif /**< lib/uring.h */
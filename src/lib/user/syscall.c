@@ -1,31 +1,64 @@
 #include <syscall.h>
+#include <sysenter.h>
 #include "../syscall-nr.h"
 
+/** Nonzero if system calls should enter the kernel through
+   SYSENTER rather than "int $0x30".  Set by syscall_probe(). */
+static char use_sysenter;
+
+/** Chooses how system calls enter the kernel.  The kernel
+   accepts SYSENTER whenever the CPU supports it, and "int $0x30"
+   always. */
+void
+syscall_probe (void) 
+{
+  use_sysenter = cpu_has_sysenter ();
+}
+
+/** Saves %ecx and %edx, which SYSENTER uses to pass the user
+   stack pointer and the address to resume at, before the caller
+   pushes the system call number and arguments. */
+#define SYSCALL_SAVE "pushl %%ecx; pushl %%edx; "
+
+/** Enters the kernel to run the system call whose number and
+   arguments the caller has pushed, leaving the result in %eax,
+   then pops the ARG_BYTES of number and arguments and restores
+   %ecx and %edx.  SYSEXIT returns to label 2 on the stack passed
+   in %ecx. */
+#define SYSCALL_TRAP(ARG_BYTES)                                 \
+        "cmpb $0, %[sysenter]; je 1f; "                         \
+        "movl %%esp, %%ecx; movl $2f, %%edx; sysenter; "        \
+        "1: int $0x30; "                                        \
+        "2: addl $" #ARG_BYTES ", %%esp; popl %%edx; popl %%ecx"
+
 /** Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            (SYSCALL_SAVE "pushl %[number]; " SYSCALL_TRAP (4)  \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
+               : [number] "i" (NUMBER),                         \
+                 [sysenter] "m" (use_sysenter)                  \
                : "memory");                                     \
           retval;                                               \
         })
 
 /** Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            (SYSCALL_SAVE "pushl %[arg0]; pushl %[number]; "    \
+             SYSCALL_TRAP (8)                                   \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [sysenter] "m" (use_sysenter),                 \
+                 [arg0] "r" (ARG0)                              \
+               : "memory");                                     \
+          retval;                                               \
         })
 
 /** Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -34,10 +67,11 @@
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+            (SYSCALL_SAVE "pushl %[arg1]; pushl %[arg0]; "      \
+             "pushl %[number]; " SYSCALL_TRAP (12)              \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [sysenter] "m" (use_sysenter),                 \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1)                              \
                : "memory");                                     \
@@ -50,10 +84,12 @@
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+            (SYSCALL_SAVE                                       \
+             "pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
+             "pushl %[number]; " SYSCALL_TRAP (16)              \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [sysenter] "m" (use_sysenter),                 \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1),                             \
                  [arg2] "r" (ARG2)                              \
@@ -61,6 +97,26 @@
           retval;                                               \
         })
 
+/** Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            (SYSCALL_SAVE                                       \
+             "pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; " SYSCALL_TRAP (20) \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [sysenter] "m" (use_sysenter),                 \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "memory");                                     \
+          retval;                                               \
+        })
+
 void
 halt (void) 
 {
@@ -182,3 +238,45 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+copy_file_range (int fd_in, int fd_out, unsigned length)
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, length);
+}
+
+int
+uring_setup (struct uring *ring)
+{
+  return syscall1 (SYS_URING_SETUP, ring);
+}
+
+int
+uring_enter (unsigned min_complete)
+{
+  return syscall1 (SYS_URING_ENTER, min_complete);
+}
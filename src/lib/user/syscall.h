@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <iovec.h>
+#include <uring.h>
 
 /** Process identifier. */
 typedef int pid_t;
@@ -19,6 +21,10 @@ typedef int mapid_t;
 #define EXIT_SUCCESS 0          /**< Successful execution. */
 #define EXIT_FAILURE 1          /**< Unsuccessful execution. */
 
+/** Chooses how system calls enter the kernel.  Called once by
+   _start() before main(). */
+void syscall_probe (void);
+
 /** Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
@@ -45,4 +51,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/** Extensions. */
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+int uring_setup (struct uring *);
+int uring_enter (unsigned min_complete);
+
 #endif /**< lib/user/syscall.h */
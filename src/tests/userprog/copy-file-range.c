@@ -0,0 +1,37 @@
+/** Copies a file into a new one with copy_file_range, checks
+   that both file positions advance, and reads the copy back. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  int src, dst;
+
+  CHECK (create ("src", sizeof sample - 1), "create \"src\"");
+  CHECK ((src = open ("src")) > 1, "open \"src\"");
+  CHECK (write (src, sample, sizeof sample - 1) == (int) sizeof sample - 1,
+         "write \"src\"");
+  seek (src, 0);
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((dst = open ("dst")) > 1, "open \"dst\"");
+  CHECK (copy_file_range (src, dst, 4096) == (int) sizeof sample - 1,
+         "copy_file_range stops at end of \"src\"");
+  CHECK (tell (src) == sizeof sample - 1 && tell (dst) == sizeof sample - 1,
+         "both positions at end");
+  CHECK (filesize (dst) == sizeof sample - 1, "\"dst\" has the right size");
+  seek (dst, 0);
+  CHECK (read (dst, buf, sizeof buf) == (int) sizeof sample - 1,
+         "read \"dst\"");
+  if (memcmp (buf, sample, sizeof sample - 1))
+    fail ("copy has wrong data");
+  msg ("close \"src\"");
+  close (src);
+  msg ("close \"dst\"");
+  close (dst);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-file-range) begin
+(copy-file-range) create "src"
+(copy-file-range) open "src"
+(copy-file-range) write "src"
+(copy-file-range) create "dst"
+(copy-file-range) open "dst"
+(copy-file-range) copy_file_range stops at end of "src"
+(copy-file-range) both positions at end
+(copy-file-range) "dst" has the right size
+(copy-file-range) read "dst"
+(copy-file-range) close "src"
+(copy-file-range) close "dst"
+(copy-file-range) end
+copy-file-range: exit(0)
+EOF
+pass;
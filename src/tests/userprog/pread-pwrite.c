@@ -0,0 +1,28 @@
+/** Writes and reads a file at explicit offsets with pwrite and
+   pread, and checks that neither moves the file position. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[16];
+  int handle;
+
+  CHECK (create ("data", sizeof sample - 1), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK (pwrite (handle, sample, sizeof sample - 1, 0)
+         == (int) sizeof sample - 1, "pwrite whole file");
+  CHECK (tell (handle) == 0, "file position still 0");
+  CHECK (pread (handle, buf, sizeof buf, 10) == (int) sizeof buf,
+         "pread %zu bytes at offset 10", sizeof buf);
+  if (memcmp (buf, sample + 10, sizeof buf))
+    fail ("pread returned wrong data");
+  CHECK (tell (handle) == 0, "file position still 0");
+  msg ("close \"data\"");
+  close (handle);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pread-pwrite) begin
+(pread-pwrite) create "data"
+(pread-pwrite) open "data"
+(pread-pwrite) pwrite whole file
+(pread-pwrite) file position still 0
+(pread-pwrite) pread 16 bytes at offset 10
+(pread-pwrite) file position still 0
+(pread-pwrite) close "data"
+(pread-pwrite) end
+pread-pwrite: exit(0)
+EOF
+pass;
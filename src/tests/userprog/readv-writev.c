@@ -0,0 +1,29 @@
+/** Writes a file from two buffers with writev and reads it back
+   into two buffers of different sizes with readv. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static char part1[] = "Scatter, ";
+  static char part2[] = "gather.";
+  char in1[5], in2[11];
+  struct iovec out[2] = {{part1, sizeof part1 - 1}, {part2, sizeof part2 - 1}};
+  struct iovec in[2] = {{in1, sizeof in1}, {in2, sizeof in2}};
+  int handle;
+
+  CHECK (create ("data", 16), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK (writev (handle, out, 2) == 16, "writev 2 segments");
+  msg ("seek \"data\" to 0");
+  seek (handle, 0);
+  CHECK (readv (handle, in, 2) == 16, "readv 2 segments");
+  if (memcmp (in1, "Scatt", sizeof in1) || memcmp (in2, "er, gather.", sizeof in2))
+    fail ("readv returned wrong data");
+  msg ("close \"data\"");
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "data"
+(readv-writev) open "data"
+(readv-writev) writev 2 segments
+(readv-writev) seek "data" to 0
+(readv-writev) readv 2 segments
+(readv-writev) close "data"
+(readv-writev) end
+readv-writev: exit(0)
+EOF
+pass;
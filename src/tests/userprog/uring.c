@@ -0,0 +1,76 @@
+/** Opens, reads, and closes a file through shared rings, with
+   the read and close submitted together in one batch.  Then
+   checks that a relative path is opened in the process's working
+   directory after a chdir, and that a read into the read-only
+   code segment fails instead of overwriting it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct uring ring __attribute__ ((aligned (4096)));
+
+/** Queues an operation in RING. */
+static void
+submit (int op, int fd, void *buf, unsigned len, unsigned user_data) 
+{
+  struct uring_sqe *sqe = &ring.sqes[ring.sq_tail % URING_ENTRIES];
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->buf = buf;
+  sqe->len = len;
+  sqe->user_data = user_data;
+  ring.sq_tail++;
+}
+
+/** Consumes the next completion in RING, checks that it belongs
+   to USER_DATA, and returns its result. */
+static int
+reap (unsigned user_data) 
+{
+  struct uring_cqe *cqe = &ring.cqes[ring.cq_head++ % URING_ENTRIES];
+  if (cqe->user_data != user_data)
+    fail ("completion for %u, expected %u", cqe->user_data, user_data);
+  return cqe->result;
+}
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  int fd;
+
+  CHECK (uring_setup (&ring) == 0, "uring_setup");
+
+  submit (URING_OP_OPEN, 0, "sample.txt", 0, 1);
+  CHECK (uring_enter (1) == 1, "submit open");
+  CHECK ((fd = reap (1)) > 1, "open \"sample.txt\"");
+
+  submit (URING_OP_READ, fd, buf, sizeof sample - 1, 2);
+  submit (URING_OP_CLOSE, fd, NULL, 0, 3);
+  CHECK (uring_enter (2) == 2, "submit read and close");
+  CHECK (reap (2) == (int) sizeof sample - 1, "read \"sample.txt\"");
+  if (memcmp (buf, sample, sizeof sample - 1))
+    fail ("read returned wrong data");
+  CHECK (reap (3) == 0, "close \"sample.txt\"");
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  CHECK (create ("dir/inner", 0), "create \"dir/inner\"");
+  CHECK (chdir ("dir"), "chdir \"dir\"");
+  submit (URING_OP_OPEN, 0, "inner", 0, 4);
+  submit (URING_OP_OPEN, 0, "sample.txt", 0, 5);
+  CHECK (uring_enter (2) == 2, "submit relative opens");
+  CHECK ((fd = reap (4)) > 1, "open \"inner\" in \"dir\"");
+  CHECK (reap (5) == -1, "open \"sample.txt\" in \"dir\" (must fail)");
+  close (fd);
+
+  submit (URING_OP_OPEN, 0, "/sample.txt", 0, 6);
+  CHECK (uring_enter (1) == 1, "submit open");
+  CHECK ((fd = reap (6)) > 1, "open \"/sample.txt\"");
+  submit (URING_OP_READ, fd, (void *) test_main, 1, 7);
+  CHECK (uring_enter (1) == 1, "submit read");
+  CHECK (reap (7) == -1, "read into code segment (must fail)");
+  close (fd);
+}
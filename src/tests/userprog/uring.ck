@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(uring) begin
+(uring) uring_setup
+(uring) submit open
+(uring) open "sample.txt"
+(uring) submit read and close
+(uring) read "sample.txt"
+(uring) close "sample.txt"
+(uring) mkdir "dir"
+(uring) create "dir/inner"
+(uring) chdir "dir"
+(uring) submit relative opens
+(uring) open "inner" in "dir"
+(uring) open "sample.txt" in "dir" (must fail)
+(uring) submit open
+(uring) open "/sample.txt"
+(uring) submit read
+(uring) read into code segment (must fail)
+(uring) end
+uring: exit(0)
+EOF
+pass;
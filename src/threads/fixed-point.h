@@ -0,0 +1,109 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <debug.h>
+#include <stdint.h>
+
+/** Signed fixed-point arithmetic in 17.14 format, for the
+   multi-level feedback queue scheduler, which must compute with
+   fractions but may not use the FPU in the kernel.
+
+   The value is wrapped in a struct so that the compiler rejects
+   mixing fixed-point and plain integers by accident. */
+
+/** Number of fraction bits. */
+#define FIX_BITS 14
+
+/** A fixed-point number. */
+typedef struct
+  {
+    int f;
+  }
+fixed_point_t;
+
+/** Returns N as a fixed-point number. */
+static inline fixed_point_t
+fix_int (int n)
+{
+  fixed_point_t x;
+  x.f = n << FIX_BITS;
+  return x;
+}
+
+/** Returns N / D as a fixed-point number. */
+static inline fixed_point_t
+fix_frac (int n, int d)
+{
+  fixed_point_t x;
+  ASSERT (d != 0);
+  x.f = ((int64_t) n << FIX_BITS) / d;
+  return x;
+}
+
+/** Returns X + Y. */
+static inline fixed_point_t
+fix_add (fixed_point_t x, fixed_point_t y)
+{
+  x.f += y.f;
+  return x;
+}
+
+/** Returns X - Y. */
+static inline fixed_point_t
+fix_sub (fixed_point_t x, fixed_point_t y)
+{
+  x.f -= y.f;
+  return x;
+}
+
+/** Returns X * Y. */
+static inline fixed_point_t
+fix_mul (fixed_point_t x, fixed_point_t y)
+{
+  x.f = ((int64_t) x.f * y.f) >> FIX_BITS;
+  return x;
+}
+
+/** Returns X / Y. */
+static inline fixed_point_t
+fix_div (fixed_point_t x, fixed_point_t y)
+{
+  ASSERT (y.f != 0);
+  x.f = ((int64_t) x.f << FIX_BITS) / y.f;
+  return x;
+}
+
+/** Returns X * N, for an integer N. */
+static inline fixed_point_t
+fix_scale (fixed_point_t x, int n)
+{
+  x.f *= n;
+  return x;
+}
+
+/** Returns X / N, for an integer N. */
+static inline fixed_point_t
+fix_unscale (fixed_point_t x, int n)
+{
+  ASSERT (n != 0);
+  x.f /= n;
+  return x;
+}
+
+/** Returns X rounded toward zero to an integer. */
+static inline int
+fix_trunc (fixed_point_t x)
+{
+  return x.f / (1 << FIX_BITS);
+}
+
+/** Returns X rounded to the nearest integer, halves away from
+   zero. */
+static inline int
+fix_round (fixed_point_t x)
+{
+  int half = 1 << (FIX_BITS - 1);
+  return (x.f >= 0 ? x.f + half : x.f - half) / (1 << FIX_BITS);
+}
+
+#endif /**< threads/fixed-point.h */
@@ -21,11 +21,13 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/schedtrace.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/strace.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -34,6 +36,9 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -49,6 +54,13 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/** -stripe: Comma-separated names of block devices to stripe
+   together into one device for the file system. */
+static char *stripe_bdev_names;
+
+/** -ramdisk: Size in kB of RAM disk to create, or 0 for none. */
+static size_t ramdisk_kb;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -129,6 +141,7 @@ pintos_init (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -259,6 +272,10 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-stripe"))
+        stripe_bdev_names = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -268,9 +285,21 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-schedtrace"))
+        {
+          schedtrace_enabled = true;
+          if (value != NULL)
+            schedtrace_ring_size = atoi (value);
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-strace"))
+        {
+          strace_enabled = true;
+          if (value != NULL)
+            strace_ring_size = atoi (value);
+        }
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -387,14 +416,19 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs together for file system.\n"
+          "  -ramdisk=KB        Create KB kB RAM disk ram0.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -schedtrace[=EVENTS]\n"
+          "                     Trace the scheduler, keeping the last EVENTS.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -strace[=EVENTS]   Trace system calls, keeping the last EVENTS.\n"
 #endif
           );
   shutdown_power_off ();
@@ -405,11 +439,26 @@ usage (void)
 static void
 locate_block_devices (void)
 {
+  struct block *ramdisk = NULL;
+
+  if (ramdisk_kb > 0)
+    ramdisk = ramdisk_init (ramdisk_kb);
+  if (stripe_bdev_names != NULL)
+    {
+      struct block *stripe = stripe_create (stripe_bdev_names);
+      if (filesys_bdev_name == NULL)
+        filesys_bdev_name = block_name (stripe);
+    }
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
   locate_block_device (BLOCK_SWAP, swap_bdev_name);
 #endif
+
+  /* A RAM disk starts out empty, so a file system on it must be
+     formatted. */
+  if (ramdisk != NULL && block_get_role (BLOCK_FILESYS) == ramdisk)
+    format_filesys = true;
 }
 
 /** Figures out what block device to use for the given ROLE: the
@@ -206,6 +206,14 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/** Returns true if a handler has been registered for interrupt
+   VEC_NO, false otherwise. */
+bool
+intr_is_registered (uint8_t vec_no) 
+{
+  return intr_handlers[vec_no] != NULL;
+}
+
 /** Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -0,0 +1,225 @@
+#include "threads/schedtrace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/** Scheduler tracer.
+
+   When enabled with -schedtrace, every context switch charges the
+   outgoing thread the CPU cycles since it was switched in, and
+   counts the switch as voluntary if the thread blocked or exited,
+   or involuntary if it was still ready to run.  A thread's totals
+   are printed when it exits, and those of threads still alive at
+   shutdown.  The time from thread_unblock() until the woken thread
+   gets the CPU goes into a histogram with power-of-two buckets.
+   If -schedtrace also gives a number of events, the most recent
+   switches are kept in a ring buffer that is printed at shutdown,
+   one per line, for offline visualisation.
+
+   With tracing disabled, the cost per switch and per wakeup is a
+   single test of schedtrace_enabled. */
+
+bool schedtrace_enabled;
+size_t schedtrace_ring_size;
+
+/** Latency histogram.  Bucket I counts wakeups that waited at
+   least 2**I cycles, and less than 2**(I + 1). */
+#define LATENCY_BUCKETS 64
+static uint64_t latency_hist[LATENCY_BUCKETS];
+
+/** One context switch. */
+struct schedtrace_event
+  {
+    uint64_t time;              /**< When, in CPU cycles. */
+    tid_t prev;                 /**< Thread switched out. */
+    tid_t next;                 /**< Thread switched in. */
+    enum thread_status status;  /**< State PREV was left in. */
+  };
+
+/** Ring buffer of the last schedtrace_ring_size events.  Event I
+   goes in slot I % schedtrace_ring_size. */
+static struct schedtrace_event *ring;
+static uint64_t event_cnt;      /**< Events ever recorded. */
+
+/** Most threads whose totals are printed at shutdown. */
+#define SNAPSHOT_MAX 32
+
+/** A live thread's totals, copied with interrupts off so that they
+   can be printed with interrupts on. */
+struct schedtrace_snapshot
+  {
+    tid_t tid;
+    char name[16];
+    uint64_t cpu_cycles;
+    unsigned vol_switches;
+    unsigned invol_switches;
+  };
+static struct schedtrace_snapshot snapshots[SNAPSHOT_MAX];
+
+static void print_thread (tid_t, const char *name, uint64_t cpu_cycles,
+                          unsigned vol_switches, unsigned invol_switches);
+static void take_snapshot (struct thread *, void *);
+
+/** Allocates the ring buffer, if one was requested, and starts
+   charging the running thread.  Must be called after
+   malloc_init(). */
+void
+schedtrace_init (void) 
+{
+  if (!schedtrace_enabled)
+    return;
+
+  thread_current ()->run_start = timer_cycles ();
+  if (schedtrace_ring_size > 0)
+    {
+      ring = calloc (schedtrace_ring_size, sizeof *ring);
+      if (ring == NULL)
+        printf ("schedtrace: no memory for %zu events\n",
+                schedtrace_ring_size);
+    }
+}
+
+/** Notes that T has just been unblocked.  Interrupts must be
+   off. */
+void
+schedtrace_wakeup (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->wakeup_time = timer_cycles ();
+}
+
+/** Records a switch from PREV to NEXT, which is now running.
+   Called from thread_schedule_tail(), with interrupts off. */
+void
+schedtrace_switch (struct thread *prev, struct thread *next) 
+{
+  uint64_t now = timer_cycles ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  prev->cpu_cycles += now - prev->run_start;
+  if (prev->status == THREAD_READY)
+    prev->invol_switches++;
+  else
+    prev->vol_switches++;
+  next->run_start = now;
+
+  if (next->wakeup_time != 0)
+    {
+      uint64_t latency = now - next->wakeup_time;
+      int bucket = 0;
+
+      while (latency >>= 1)
+        bucket++;
+      latency_hist[bucket]++;
+      next->wakeup_time = 0;
+    }
+
+  if (ring != NULL)
+    {
+      struct schedtrace_event *e = &ring[event_cnt++ % schedtrace_ring_size];
+
+      e->time = now;
+      e->prev = prev->tid;
+      e->next = next->tid;
+      e->status = prev->status;
+    }
+}
+
+/** Prints the running thread's totals.  Called by thread_exit(). */
+void
+schedtrace_exit (void) 
+{
+  struct thread *cur = thread_current ();
+
+  if (!schedtrace_enabled)
+    return;
+
+  print_thread (cur->tid, cur->name,
+                cur->cpu_cycles + (timer_cycles () - cur->run_start),
+                cur->vol_switches, cur->invol_switches);
+}
+
+/** Prints the totals of the threads still alive, the wakeup latency
+   histogram, and the events in the ring buffer, oldest first. */
+void
+schedtrace_print_stats (void) 
+{
+  static const char *states[] = {"running", "ready", "blocked", "dying"};
+  size_t snapshot_cnt = 0;
+  enum intr_level old_level;
+  uint64_t first, i;
+  int bucket;
+
+  if (!schedtrace_enabled)
+    return;
+
+  old_level = intr_disable ();
+  thread_foreach (take_snapshot, &snapshot_cnt);
+  intr_set_level (old_level);
+  for (i = 0; i < snapshot_cnt && i < SNAPSHOT_MAX; i++)
+    print_thread (snapshots[i].tid, snapshots[i].name,
+                  snapshots[i].cpu_cycles, snapshots[i].vol_switches,
+                  snapshots[i].invol_switches);
+  if (snapshot_cnt > SNAPSHOT_MAX)
+    printf ("schedtrace: %zu more threads not shown\n",
+            snapshot_cnt - SNAPSHOT_MAX);
+
+  printf ("schedtrace: wakeup latency, cycles\n");
+  for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    if (latency_hist[bucket] > 0)
+      printf ("  >= %20"PRIu64": %"PRIu64"\n",
+              (uint64_t) 1 << bucket, latency_hist[bucket]);
+
+  if (ring == NULL)
+    return;
+  first = (event_cnt > schedtrace_ring_size
+           ? event_cnt - schedtrace_ring_size : 0);
+  printf ("schedtrace: last %"PRIu64" of %"PRIu64" switches "
+          "(cycles, from tid, to tid, from state)\n",
+          event_cnt - first, event_cnt);
+  for (i = first; i < event_cnt; i++) 
+    {
+      struct schedtrace_event *e = &ring[i % schedtrace_ring_size];
+      printf ("  %"PRIu64" %d %d %s\n",
+              e->time, e->prev, e->next, states[e->status]);
+    }
+}
+
+/** Prints one thread's totals. */
+static void
+print_thread (tid_t tid, const char *name, uint64_t cpu_cycles,
+              unsigned vol_switches, unsigned invol_switches) 
+{
+  printf ("schedtrace: %s (tid %d): %"PRIu64" cycles on CPU, "
+          "%u voluntary and %u involuntary switches\n",
+          name, tid, cpu_cycles, vol_switches, invol_switches);
+}
+
+/** Copies T's totals into the next free snapshot, counting in
+   *CNT_ all threads, including those that do not fit.  The
+   running thread is charged up to now. */
+static void
+take_snapshot (struct thread *t, void *cnt_) 
+{
+  size_t *cnt = cnt_;
+
+  if (*cnt < SNAPSHOT_MAX)
+    {
+      struct schedtrace_snapshot *s = &snapshots[*cnt];
+
+      s->tid = t->tid;
+      strlcpy (s->name, t->name, sizeof s->name);
+      s->cpu_cycles = t->cpu_cycles;
+      if (t->status == THREAD_RUNNING)
+        s->cpu_cycles += timer_cycles () - t->run_start;
+      s->vol_switches = t->vol_switches;
+      s->invol_switches = t->invol_switches;
+    }
+  (*cnt)++;
+}
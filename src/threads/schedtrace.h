@@ -0,0 +1,22 @@
+#ifndef THREADS_SCHEDTRACE_H
+#define THREADS_SCHEDTRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct thread;
+
+/** -schedtrace: Trace the scheduler? */
+extern bool schedtrace_enabled;
+
+/** -schedtrace=EVENTS: Number of context switches to keep in the
+   trace ring buffer, or 0 to only keep statistics. */
+extern size_t schedtrace_ring_size;
+
+void schedtrace_init (void);
+void schedtrace_wakeup (struct thread *);
+void schedtrace_switch (struct thread *prev, struct thread *next);
+void schedtrace_exit (void);
+void schedtrace_print_stats (void);
+
+#endif /**< threads/schedtrace.h */
@@ -32,6 +32,17 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/** Maximum length of a chain of lock holders through which a
+   priority is donated, so that a waiter does constant work even
+   when locks are nested deeply. */
+#define DONATION_DEPTH_MAX 8
+
+static bool thread_priority_less (const struct list_elem *,
+                                  const struct list_elem *, void *aux);
+static int waiters_priority (struct semaphore *);
+static void donate_priority (struct lock *, int priority);
+static void lock_take (struct lock *);
+
 /** Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -102,7 +113,8 @@ sema_try_down (struct semaphore *sema)
 }
 
 /** Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, yielding to it if it has a higher priority.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +126,17 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      /* Waiters' priorities may be raised by donation while they
+         wait, so the list is not kept sorted. */
+      struct list_elem *e = list_max (&sema->waiters,
+                                      thread_priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+  thread_preempt ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -179,6 +198,7 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->priority = PRI_MIN;
 }
 
 /** Acquires LOCK, sleeping until it becomes available if
@@ -188,16 +208,31 @@ lock_init (struct lock *lock)
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
-   we need to sleep. */
+   we need to sleep.
+
+   While the current thread waits, its priority is donated to the
+   holder, and on through the locks the holder waits for, up to
+   DONATION_DEPTH_MAX holders deep. */
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      cur->waiting_lock = lock;
+      donate_priority (lock, cur->priority);
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock_take (lock);
+  intr_set_level (old_level);
 }
 
 /** Tries to acquires LOCK and returns true if successful or false
@@ -216,7 +251,11 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      enum intr_level old_level = intr_disable ();
+      lock_take (lock);
+      intr_set_level (old_level);
+    }
   return success;
 }
 
@@ -224,14 +263,23 @@ lock_try_acquire (struct lock *lock)
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
-   handler. */
+   handler.
+
+   The current thread gives up the priorities donated through
+   LOCK, and yields if a waiter now outranks it. */
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  list_remove (&lock->elem);
+  thread_update_priority ();
+  intr_set_level (old_level);
   sema_up (&lock->semaphore);
 }
 
@@ -246,13 +294,86 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/** Makes the current thread the holder of LOCK, which it has
+   just downed.  Threads still waiting for LOCK keep donating to
+   the new holder.  Interrupts must be off. */
+static void
+lock_take (struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = cur;
+  lock->priority = thread_mlfqs ? PRI_MIN : waiters_priority (&lock->semaphore);
+  list_push_back (&cur->held_locks, &lock->elem);
+  thread_update_priority ();
+}
+
+/** Donates PRIORITY through LOCK to its holder, and if the holder
+   is itself waiting for a lock, through that lock to its holder,
+   and so on, at most DONATION_DEPTH_MAX times.  Stops early once
+   a lock already carries PRIORITY.  Interrupts must be off. */
+static void
+donate_priority (struct lock *lock, int priority) 
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+
+      if (lock->priority >= priority)
+        break;
+      lock->priority = priority;
+      if (holder == NULL)
+        break;
+      thread_donate_priority (holder, priority);
+      lock = holder->waiting_lock;
+    }
+}
+
+/** Returns the highest priority among the threads waiting for
+   SEMA, or PRI_MIN if there are none.  Interrupts must be off. */
+static int
+waiters_priority (struct semaphore *sema) 
+{
+  if (list_empty (&sema->waiters))
+    return PRI_MIN;
+  return list_entry (list_max (&sema->waiters, thread_priority_less, NULL),
+                     struct thread, elem)->priority;
+}
+
+/** Returns true if the thread that owns list element A has a
+   lower priority than the one that owns B. */
+static bool
+thread_priority_less (const struct list_elem *a, const struct list_elem *b,
+                      void *aux UNUSED) 
+{
+  return list_entry (a, struct thread, elem)->priority
+         < list_entry (b, struct thread, elem)->priority;
+}
+
 /** One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /**< List element. */
     struct semaphore semaphore;         /**< This semaphore. */
+    struct thread *thread;              /**< Thread waiting on it. */
   };
 
+/** Returns true if the thread waiting on semaphore_elem A has a
+   lower priority than the one waiting on B. */
+static bool
+waiter_priority_less (const struct list_elem *a, const struct list_elem *b,
+                      void *aux UNUSED) 
+{
+  return list_entry (a, struct semaphore_elem, elem)->thread->priority
+         < list_entry (b, struct semaphore_elem, elem)->thread->priority;
+}
+
 /** Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -295,6 +416,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -302,7 +424,8 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /** If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest-priority one of them to wake
+   up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -317,8 +440,12 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters,
+                                      waiter_priority_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
 }
 
 /** Wakes up all threads, if any, waiting on COND (protected by
@@ -22,6 +22,8 @@ struct lock
   {
     struct thread *holder;      /**< Thread holding lock (for debugging). */
     struct semaphore semaphore; /**< Binary semaphore controlling access. */
+    int priority;               /**< Highest priority donated through it. */
+    struct list_elem elem;      /**< Element in holder's held_locks. */
   };
 
 void lock_init (struct lock *);
@@ -8,9 +8,11 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/schedtrace.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -24,9 +26,20 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/** List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/** Number of thread priorities. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/** Lists of processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running, one list per
+   priority.  Each list is in FIFO order. */
+static struct list ready_queues[PRI_CNT];
+
+/** Bit P is set if and only if ready_queues[P] is nonempty, so
+   that the highest ready priority can be found in constant time. */
+static uint64_t ready_mask;
+
+/** Number of threads in the run queues. */
+static int ready_cnt;
 
 /** List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -63,11 +76,29 @@ static unsigned thread_ticks;   /**< # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/** Multi-level feedback queue scheduler. */
+#define NICE_MIN -20            /**< Lowest niceness. */
+#define NICE_MAX 20             /**< Highest niceness. */
+static fixed_point_t load_avg;  /**< Estimated # of ready threads. */
+
+/** Threads whose recent_cpu changed since their priorities were
+   last computed.  Only these need new priorities every
+   TIME_SLICE ticks, which between once-a-second decays is just
+   the few threads that ran. */
+static struct list charged_list;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static void change_priority (struct thread *, int priority);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_charge (struct thread *);
+static int mlfqs_priority (const struct thread *);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -91,10 +122,15 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int pri;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
+  ready_mask = 0;
+  list_init (&charged_list);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -111,6 +147,8 @@ thread_start (void)
 {
   /* Create the idle thread. */
   struct semaphore idle_started;
+
+  schedtrace_init ();
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
 
@@ -121,8 +159,10 @@ thread_start (void)
   sema_down (&idle_started);
 }
 
-/** Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+/** Called by the timer interrupt handler at each timer tick, or
+   for each tick that passed without an interrupt when the timer
+   leaves tickless mode.  Runs with interrupts off, usually in an
+   external interrupt context. */
 void
 thread_tick (void) 
 {
@@ -138,8 +178,12 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
+  /* Enforce preemption.  Outside an interrupt handler, the timer
+     is only catching up, and the next tick will preempt. */
+  if (++thread_ticks >= TIME_SLICE && intr_context ())
     intr_yield_on_return ();
 }
 
@@ -149,6 +193,7 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  schedtrace_print_stats ();
 }
 
 /** Creates a new kernel thread named NAME with the given initial
@@ -163,9 +208,9 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If PRIORITY is higher than the running thread's, the new
+   thread runs before thread_create() returns, unless interrupts
+   are off. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -211,7 +256,6 @@ thread_create (const char *name, int priority,
   c_t->tid = tid; 				    // Current thread setting the child tid for the parent
   c_t->child_done = 0;				    // Child was just created so it is not done with its application 
   list_push_back(&thread_current()->child_list, &c_t->child_elem);
-  t->fd_ct = 1;
 
   /* Add to run queue. */
   thread_unblock (t);
@@ -239,10 +283,12 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the running
+   thread is preempted, but only if interrupts were on or this is
+   an interrupt handler: a caller that disabled interrupts itself
+   may expect that it can atomically unblock a thread and update
+   other data, and should call thread_preempt() once it turns
+   interrupts back on. */
 void
 thread_unblock (struct thread *t) 
 {
@@ -252,9 +298,48 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
+  if (schedtrace_enabled)
+    schedtrace_wakeup (t);
+
+  /* Time slicing needs every tick once two threads can run. */
+  if (ready_cnt + (thread_current () != idle_thread) > 1)
+    timer_nohz_exit ();
   intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/** Returns true if no thread is ready to run, so that the running
+   thread keeps the CPU until another thread is unblocked.
+   Interrupts must be off. */
+bool
+thread_none_ready (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return ready_cnt == 0;
+}
+
+/** Yields the CPU if a ready thread has a higher priority than
+   the running thread.  In an interrupt handler, yields on return
+   from the interrupt instead.  Does nothing if interrupts are
+   off outside an interrupt handler. */
+void
+thread_preempt (void) 
+{
+  enum intr_level old_level;
+  bool preempt;
+
+  old_level = intr_disable ();
+  preempt = ready_max_priority () > thread_current ()->priority;
+  intr_set_level (old_level);
+
+  if (!preempt)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_yield ();
 }
 
 /** Returns the name of the running thread. */
@@ -299,12 +384,15 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  schedtrace_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  if (thread_current ()->charged)
+    list_remove (&thread_current ()->charged_elem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -322,7 +410,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -345,11 +433,63 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/** Sets the current thread's priority to NEW_PRIORITY. */
+/** Sets the current thread's base priority to NEW_PRIORITY, and
+   yields if that leaves a ready thread with a higher priority.
+   Priorities donated to the thread still apply.  Does nothing
+   under the MLFQS, which computes priorities itself. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  thread_current ()->base_priority = new_priority;
+  thread_update_priority ();
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/** Raises T's priority to PRIORITY, if that is higher, on behalf
+   of a thread waiting for a lock that T holds.  Does not
+   preempt.  Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, int priority) 
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority > t->priority)
+    change_priority (t, priority);
+}
+
+/** Recomputes the running thread's priority as the higher of its
+   base priority and the priorities donated through the locks it
+   holds.  Does not preempt.  Interrupts must be off.  Does
+   nothing under the MLFQS, which does not donate. */
+void
+thread_update_priority (void) 
+{
+  struct thread *cur = thread_current ();
+  int priority = cur->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return;
+  for (e = list_begin (&cur->held_locks); e != list_end (&cur->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->priority > priority)
+        priority = lock->priority;
+    }
+  cur->priority = priority;
 }
 
 /** Returns the current thread's priority. */
@@ -359,35 +499,134 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/** Sets the current thread's nice value to NICE. */
+/** Sets the current thread's nice value to NICE.  Under the
+   multi-level feedback queue scheduler, also recomputes its
+   priority and yields if it no longer has the highest; otherwise
+   the nice value has no effect on scheduling. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  else if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    cur->priority = mlfqs_priority (cur);
+  intr_set_level (old_level);
+  if (thread_mlfqs)
+    thread_preempt ();
 }
 
 /** Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /** Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fix_round (fix_scale (load_avg, 100));
+  intr_set_level (old_level);
+  return load;
 }
 
 /** Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fix_round (fix_scale (thread_current ()->recent_cpu, 100));
+  intr_set_level (old_level);
+  return recent;
+}
+
+/** Does the MLFQS bookkeeping for timer tick, with CUR running.
+   CUR is charged the tick.  Once a second the load average is
+   updated and every thread's recent_cpu decays.  Every
+   TIME_SLICE ticks, charged threads get new priorities. */
+static void
+mlfqs_tick (struct thread *cur) 
+{
+  int64_t ticks = timer_ticks ();
+
+  if (cur != idle_thread)
+    {
+      cur->recent_cpu = fix_add (cur->recent_cpu, fix_int (1));
+      mlfqs_charge (cur);
+    }
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      int ready_threads = ready_cnt + (cur != idle_thread);
+      fixed_point_t coeff;
+      struct list_elem *e;
+
+      load_avg = fix_add (fix_mul (fix_frac (59, 60), load_avg),
+                          fix_frac (ready_threads, 60));
+      coeff = fix_div (fix_scale (load_avg, 2),
+                       fix_add (fix_scale (load_avg, 2), fix_int (1)));
+
+      /* A thread with no recent_cpu and no niceness stays at
+         zero, so its priority need not be recomputed. */
+      for (e = list_begin (&all_list); e != list_end (&all_list);
+           e = list_next (e))
+        {
+          struct thread *t = list_entry (e, struct thread, allelem);
+          fixed_point_t old = t->recent_cpu;
+
+          t->recent_cpu = fix_add (fix_mul (coeff, t->recent_cpu),
+                                   fix_int (t->nice));
+          if (t->recent_cpu.f != old.f)
+            mlfqs_charge (t);
+        }
+    }
+
+  if (ticks % TIME_SLICE == 0)
+    {
+      while (!list_empty (&charged_list))
+        {
+          struct thread *t = list_entry (list_pop_front (&charged_list),
+                                         struct thread, charged_elem);
+          t->charged = false;
+          change_priority (t, mlfqs_priority (t));
+        }
+      thread_preempt ();
+    }
+}
+
+/** Notes that T's recent_cpu has changed. */
+static void
+mlfqs_charge (struct thread *t) 
+{
+  if (!t->charged && t != idle_thread)
+    {
+      list_push_back (&charged_list, &t->charged_elem);
+      t->charged = true;
+    }
+}
+
+/** Returns the priority the MLFQS gives T. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  int priority = PRI_MAX - fix_trunc (fix_unscale (t->recent_cpu, 4))
+                 - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  return priority;
 }
 
 /** Idle thread.  Executes when no other thread is ready to run.
@@ -477,11 +716,24 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->magic = THREAD_MAGIC;
+  if (thread_mlfqs)
+    {
+      /* A new thread inherits its creator's niceness and recent
+         CPU time, and its priority follows from them. */
+      if (t != initial_thread)
+        {
+          t->nice = thread_current ()->nice;
+          t->recent_cpu = thread_current ()->recent_cpu;
+        }
+      t->priority = mlfqs_priority (t);
+    }
+  t->base_priority = t->priority;
+  list_init (&t->held_locks);
   // NEW: Used for communicating between parent and children threads 
   sema_init(&t->sem_child_load, 0);
   sema_init(&t->sem_child_wait,0);
   list_init(&t->child_list);
-  list_init(&t->list_files);
+  t->fd_next = 2;  // 0 and 1 are the console
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -501,18 +753,83 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/** Adds T to the back of the run queue for its priority. */
+static void
+ready_push (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/** Removes T, which must be ready, from its run queue. */
+static void
+ready_remove (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/** Sets T's priority to PRIORITY, moving T to the matching run
+   queue if it is ready.  Does not preempt. */
+static void
+change_priority (struct thread *t, int priority) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority == priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+}
+
+/** Returns the priority of the highest-priority ready thread, or
+   -1 if no thread is ready. */
+static int
+ready_max_priority (void) 
+{
+  uint32_t hi = ready_mask >> 32;
+  uint32_t lo = ready_mask;
+
+  if (hi != 0)
+    return 63 - __builtin_clz (hi);
+  else if (lo != 0)
+    return 31 - __builtin_clz (lo);
+  else
+    return -1;
+}
+
 /** Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.  Takes constant time: the highest nonempty
+   priority queue is found from ready_mask. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int pri = ready_max_priority ();
+  struct thread *t;
+
+  if (pri < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  t = list_entry (list_front (&ready_queues[pri]), struct thread, elem);
+  ready_remove (t);
+  return t;
 }
 
 /** Completes a thread switch by activating the new thread's page
@@ -541,6 +858,9 @@ thread_schedule_tail (struct thread *prev)
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
 
+  if (schedtrace_enabled && prev != NULL)
+    schedtrace_switch (prev, cur);
+
   /* Start new time slice. */
   thread_ticks = 0;
 
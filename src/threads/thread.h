@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
+#include "threads/fixed-point.h"
 
 /** States in a thread's life cycle. */
 enum thread_status
@@ -91,9 +92,24 @@ struct thread
     int priority;                       /**< Priority. */
     struct list_elem allelem;           /**< List element for all threads list. */
 
+    /* Owned by thread.c, used only by the MLFQS. */
+    int nice;                           /**< Niceness. */
+    fixed_point_t recent_cpu;           /**< Recent CPU time used. */
+    bool charged;                       /**< On charged_list? */
+    struct list_elem charged_elem;      /**< Element in charged_list. */
+
+    /* Owned by threads/schedtrace.c. */
+    uint64_t run_start;                 /**< When it last got the CPU. */
+    uint64_t wakeup_time;               /**< When last unblocked, or 0. */
+    uint64_t cpu_cycles;                /**< Time on the CPU until then. */
+    unsigned vol_switches;              /**< Times it blocked or exited. */
+    unsigned invol_switches;            /**< Times it left still ready. */
+
     /* Shared between thread.c and synch.c. */
-    int64_t ticks_to_sleep;
     struct list_elem elem;              /**< List element. */
+    int base_priority;                  /**< Priority without donations. */
+    struct lock *waiting_lock;          /**< Lock being waited for, if any. */
+    struct list held_locks;             /**< Locks held, for donations. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
@@ -103,9 +119,16 @@ struct thread
     // NEW: exit status code
     int exit_status; 
 
-    // NEW: thread file list
-    struct list list_files;
-    int fd_ct;
+    // NEW: thread file descriptor table, indexed by fd
+    struct file **fd_table;            // Open file for each fd, NULL if free
+    int fd_cap;                        // Number of entries in fd_table
+    int fd_next;                       // No fd below this one is free
+
+    // NEW: system call trace statistics, NULL until the first traced call
+    struct strace_stats *strace;
+
+    // NEW: shared submission and completion rings, NULL if not set up
+    struct uring_ctx *uring;
     
     
     // NEW: Used for communicating between parent and children threads
@@ -150,6 +173,8 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
+bool thread_none_ready (void);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -164,6 +189,8 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int priority);
+void thread_update_priority (void);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
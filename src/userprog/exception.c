@@ -4,6 +4,7 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "userprog/uaccess.h"
 
 /** Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,6 +149,18 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* A fault in the kernel while it accesses user memory on a
+     process's behalf makes that access fail; the caller then
+     decides what to do about the bad address. */
+  if (!user)
+    {
+      uintptr_t fixup = uaccess_fixup ((uintptr_t) f->eip);
+      if (fixup != 0)
+        {
+          f->eip = (void (*) (void)) fixup;
+          return;
+        }
+    }
   
   // Find our child struct that the parent thread holds
   struct child *c_t = find_child(thread_current()->tid, thread_current()->parent);
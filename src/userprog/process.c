@@ -7,7 +7,9 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/strace.h"
 #include "userprog/tss.h"
+#include "userprog/uring.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -28,6 +30,7 @@
 
 // NEW: for synchronizations
 #include "threads/synch.h"
+#include "userprog/syscall.h"
 
 #define MAX_ARGS_LEN 4096 // NEW: max size for user program arguments
 
@@ -255,6 +258,8 @@ process_exit (void)
   // Print the exit message 
   char * saveptr;
   printf("%s: exit(%d)\n",strtok_r(cur->name, " ", saveptr),cur->exit_status);
+  // NEW: report and free this process's system call statistics
+  strace_exit();
   
   debug_printf("(process_exit) destroying child threads\n");
   // NEW: destroy the children threads
@@ -268,7 +273,11 @@ process_exit (void)
   }
   debug_printf("(process_exit) Child threads destroyed\n");  
 
-  // FIXME: deallocate file memory
+  // NEW: stop the uring worker using our files and memory
+  uring_exit();
+
+  // NEW: close any files the process left open and free its fd table
+  close_all_files();
   
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -0,0 +1,161 @@
+#include "userprog/strace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <syscall-nr.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/syscall.h"
+
+/** System call tracer.
+
+   When enabled with -strace, every system call that returns is
+   recorded in two places.  Each process accumulates a count and
+   the total and maximum latency, in CPU cycles, of each system
+   call it makes, and prints them when it exits.  If -strace also
+   gives a number of events, the most recent calls from all
+   processes are also kept, arguments and result included, in a
+   ring buffer that is printed at shutdown.
+
+   exit() and halt() never return, so they are not recorded.
+   With tracing disabled, the cost per system call is a single
+   test of strace_enabled. */
+
+bool strace_enabled;
+size_t strace_ring_size;
+
+/** Per-process statistics for one system call. */
+struct strace_count
+  {
+    unsigned calls;             /**< Number of calls. */
+    uint64_t total_cycles;      /**< Total latency. */
+    uint64_t max_cycles;        /**< Longest latency. */
+  };
+
+/** Per-process statistics for every system call. */
+struct strace_stats
+  {
+    struct strace_count counts[SYS_CNT];
+  };
+
+/** One traced system call. */
+struct strace_event
+  {
+    tid_t tid;                  /**< Calling thread. */
+    int nr;                     /**< System call number. */
+    int arg_cnt;                /**< Number of arguments. */
+    int args[STRACE_MAX_ARGS];  /**< Arguments. */
+    int result;                 /**< Return value. */
+    uint64_t cycles;            /**< Latency. */
+  };
+
+/** Ring buffer of the last strace_ring_size events.  Event I
+   goes in slot I % strace_ring_size. */
+static struct strace_event *ring;
+static uint64_t event_cnt;      /**< Events ever recorded. */
+
+/** Allocates the ring buffer, if one was requested.  Must be
+   called after malloc_init(). */
+void
+strace_init (void) 
+{
+  if (strace_enabled && strace_ring_size > 0)
+    {
+      ring = calloc (strace_ring_size, sizeof *ring);
+      if (ring == NULL)
+        printf ("strace: no memory for %zu events\n", strace_ring_size);
+    }
+}
+
+/** Records that system call NR, with the ARG_CNT arguments in
+   ARGS, returned RESULT after CYCLES cycles in the running
+   process. */
+void
+strace_record (int nr, const int *args, int arg_cnt, int result,
+               uint64_t cycles) 
+{
+  struct thread *cur = thread_current ();
+  struct strace_count *count;
+
+  ASSERT (nr >= 0 && nr < SYS_CNT);
+  ASSERT (arg_cnt <= STRACE_MAX_ARGS);
+
+  if (cur->strace == NULL)
+    {
+      cur->strace = calloc (1, sizeof *cur->strace);
+      if (cur->strace == NULL)
+        return;
+    }
+  count = &cur->strace->counts[nr];
+  count->calls++;
+  count->total_cycles += cycles;
+  if (cycles > count->max_cycles)
+    count->max_cycles = cycles;
+
+  if (ring != NULL)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct strace_event *e = &ring[event_cnt++ % strace_ring_size];
+      int i;
+
+      e->tid = cur->tid;
+      e->nr = nr;
+      e->arg_cnt = arg_cnt;
+      for (i = 0; i < arg_cnt; i++)
+        e->args[i] = args[i];
+      e->result = result;
+      e->cycles = cycles;
+      intr_set_level (old_level);
+    }
+}
+
+/** Prints and frees the running process's statistics.  Called
+   by process_exit(). */
+void
+strace_exit (void) 
+{
+  struct thread *cur = thread_current ();
+  int nr;
+
+  if (cur->strace == NULL)
+    return;
+
+  printf ("strace: %s (tid %d)\n", cur->name, cur->tid);
+  printf ("  %-10s %8s %14s %14s\n",
+          "syscall", "calls", "avg cycles", "max cycles");
+  for (nr = 0; nr < SYS_CNT; nr++) 
+    {
+      struct strace_count *count = &cur->strace->counts[nr];
+      if (count->calls > 0)
+        printf ("  %-10s %8u %14"PRIu64" %14"PRIu64"\n",
+                syscall_name (nr), count->calls,
+                count->total_cycles / count->calls, count->max_cycles);
+    }
+
+  free (cur->strace);
+  cur->strace = NULL;
+}
+
+/** Prints the events in the ring buffer, oldest first. */
+void
+strace_print_stats (void) 
+{
+  uint64_t first, i;
+
+  if (ring == NULL)
+    return;
+
+  first = event_cnt > strace_ring_size ? event_cnt - strace_ring_size : 0;
+  printf ("strace: last %"PRIu64" of %"PRIu64" system calls\n",
+          event_cnt - first, event_cnt);
+  for (i = first; i < event_cnt; i++) 
+    {
+      struct strace_event *e = &ring[i % strace_ring_size];
+      int j;
+
+      printf ("  tid %d: %s(", e->tid, syscall_name (e->nr));
+      for (j = 0; j < e->arg_cnt; j++)
+        printf ("%s%#x", j > 0 ? ", " : "", e->args[j]);
+      printf (") = %d, %"PRIu64" cycles\n", e->result, e->cycles);
+    }
+}
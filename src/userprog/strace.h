@@ -0,0 +1,24 @@
+#ifndef USERPROG_STRACE_H
+#define USERPROG_STRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Most arguments any system call takes. */
+#define STRACE_MAX_ARGS 4
+
+/** -strace: Trace system calls? */
+extern bool strace_enabled;
+
+/** -strace=EVENTS: Number of events to keep in the trace ring
+   buffer, or 0 to only count calls. */
+extern size_t strace_ring_size;
+
+void strace_init (void);
+void strace_record (int nr, const int *args, int arg_cnt, int result,
+                    uint64_t cycles);
+void strace_exit (void);
+void strace_print_stats (void);
+
+#endif /**< userprog/strace.h */
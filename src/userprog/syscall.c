@@ -1,12 +1,23 @@
 #include "userprog/syscall.h"
 #include "devices/shutdown.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/loader.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "userprog/pagedir.h"
+#include "userprog/strace.h"
+#include "userprog/uring.h"
+#include "userprog/tss.h"
+#include "userprog/uaccess.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <sysenter.h>
 
 // used to toggle print statements
 //#define debug_printf(fmt, ...) printf(fmt, ##__VA_ARGS__)
@@ -14,252 +25,286 @@
 //#define debug_extra_printf(fmt, ...) printf(fmt, ##__VA_ARGS__)
 #define debug_extra_printf(fmt, ...) // Uncomment to turn debugger off and comment above
 
+#define FD_MIN 2         /* Lowest fd for files, 0 and 1 are the console */
+#define FD_TABLE_INIT 16 /* Initial number of entries in an fd table */
+#define SYSCALL_MAX_ARGS 4 /* Most arguments any system call takes */
+
+// Model-specific registers read by SYSENTER, see [IA32-v3a] 5.8.7
+#define MSR_SYSENTER_CS 0x174  /* Kernel code segment, stack segment follows */
+#define MSR_SYSENTER_ESP 0x175 /* Kernel stack pointer */
+#define MSR_SYSENTER_EIP 0x176 /* Kernel entry point */
+
 static void syscall_handler(struct intr_frame *);
-bool valid_addr(void * vaddr);
-bool valid_str(char *str);
+void sysenter_entry(void);
+
+/* Write value to the model-specific register msr */
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
 
 void syscall_init(void) {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
+
+  // Also accept system calls through SYSENTER when the CPU has it. The
+  // entry stub loads its stack through the TSS's esp0, which already
+  // follows the running thread, so the MSRs never change after this
+  if (cpu_has_sysenter()) {
+    wrmsr(MSR_SYSENTER_CS, SEL_KCSEG);
+    wrmsr(MSR_SYSENTER_ESP, (uintptr_t) tss_esp0());
+    wrmsr(MSR_SYSENTER_EIP, (uintptr_t) sysenter_entry);
+  }
   lock_init(&file_lock);
   lock_init(&process_lock);
+  strace_init();
+  uring_init();
 }
 
 
-bool valid_addr(void *vaddr) {
-      // Check if the virtual address is not a null pointer
-    if (vaddr == NULL) {
-        debug_printf("Nonetype vaddr\n");
-        return false;
-    }
+/* Copy the n syscall arguments that follow the syscall number at stack_p
+   into args, exiting the process if they are not in mapped user memory */
+static void get_args(const int *stack_p, int *args, int n) {
+  if (!copy_from_user(args, stack_p + 1, n * sizeof *args)) {
+    debug_printf("get_args(): bad argument pointer\n");
+    exit(-1);
+  }
+}
 
-    // Check if the virtual address is in the user address space
-    if (!is_user_vaddr(vaddr) || (vaddr >= 0xbffffffc)) {
-        debug_printf("invalid vaddr\n");
-        return false;
-    }
+/* Copy the user string at ustr into a new kernel page, exiting the process
+   if it is not in mapped user memory or does not fit in the page. The
+   caller must free the page with palloc_free_page() */
+static char *get_str(const char *ustr) {
+  char *kstr = palloc_get_page(0);
+  if (kstr == NULL || !copy_str_from_user(kstr, ustr, PGSIZE)) {
+    debug_printf("get_str(): bad string pointer\n");
+    palloc_free_page(kstr);
+    exit(-1);
+  }
+  return kstr;
+}
 
-    // Check if the page is valid    
-    if (pagedir_get_page(thread_current()->pagedir, vaddr) == NULL) {
-        debug_printf("Invalid vaddr page\n");
-        return false;
-    }
+/* A system call handler takes the call's arguments, already copied in
+   from the user stack, and returns the value for the caller's eax */
+typedef int syscall_func(const int *args);
 
-    // Return true otherwise
-    debug_extra_printf("No issue found in vaddr\n");
-    return true;
+//~~~~~ Project 2 system calls ~~~~~
+static int sys_halt(const int *args UNUSED) {
+  halt();
+  NOT_REACHED();
 }
 
-bool valid_str(char *str){
-    // Check if the str is in the user address space
-    if (!is_user_vaddr(str)) {
-        debug_printf("invalid str addr\n");
-        return false;
-    }
+static int sys_exit(const int *args) {
+  exit(args[0]);
+  NOT_REACHED();
+}
 
-    // Check if the string is in the correct page
-    char *page_str = pagedir_get_page(thread_current()->pagedir, (void *) str);
-    if(page_str == NULL){
-      // Checking if the first part is in the correct page
-      debug_printf("invalid str page NULL\n");
-      return false;
-    }else{
-      // Checking if the last part + null terminator is in the correct page
-      char *end_str = str + strlen(page_str) + 1;
-      if (!is_user_vaddr(end_str) || pagedir_get_page(thread_current()->pagedir, end_str) == NULL) {
-        debug_extra_printf("invalid str end page or vaddr\n");
-        return false;
-  	  }
-    }
-    // Otherwise return true
-    debug_extra_printf("No issue found in str\n");
-    return true;
+static int sys_exec(const int *args) {
+  char *str = get_str((const char *) args[0]);
+  int result = exec(str);
+  palloc_free_page(str);
+  return result;
 }
 
-static void syscall_handler(struct intr_frame *f UNUSED) {
-  // Get stack pointer via "esp" of intr_frame
-  int *stack_p = f->esp;
-  debug_printf("(syscall_handler) Stack pointer : 0x%x and funct [%d]\n", 
-      (uintptr_t)f->esp, *stack_p);
+static int sys_wait(const int *args) {
+  return wait(args[0]);
+}
 
-  // Check if stack pointer is within user address space and is mapped to a valid page
-  if (!valid_addr(stack_p)) {
-    debug_printf("syscall_handler(): Invalid call stack ptr\n");
+static int sys_create(const int *args) {
+  char *str = get_str((const char *) args[0]);
+  int result = create(str, args[1]);
+  palloc_free_page(str);
+  return result;
+}
+
+static int sys_remove(const int *args) {
+  char *str = get_str((const char *) args[0]);
+  int result = remove(str);
+  palloc_free_page(str);
+  return result;
+}
+
+static int sys_open(const int *args) {
+  char *str = get_str((const char *) args[0]);
+  int result = open(str);
+  palloc_free_page(str);
+  return result;
+}
+
+static int sys_filesize(const int *args) {
+  return filesize(args[0]);
+}
+
+static int sys_read(const int *args) {
+  return read(args[0], (void *) args[1], args[2]);
+}
+
+static int sys_write(const int *args) {
+  return write(args[0], (const void *) args[1], args[2]);
+}
+
+static int sys_seek(const int *args) {
+  seek(args[0], args[1]);
+  return 0;
+}
+
+static int sys_tell(const int *args) {
+  return tell(args[0]);
+}
+
+static int sys_close(const int *args) {
+  close(args[0]);
+  return 0;
+}
+
+//~~~~~ Project 4 system calls ~~~~~
+static int sys_mkdir(const int *args) {
+  char *str = get_str((const char *) args[0]);
+  int result = mkdir(str);
+  palloc_free_page(str);
+  return result;
+}
+
+static int sys_chdir(const int *args) {
+  char *str = get_str((const char *) args[0]);
+  int result = chdir(str);
+  palloc_free_page(str);
+  return result;
+}
+
+static int sys_readdir(const int *args) {
+  return readdir(args[0], (char *) args[1]);
+}
+
+static int sys_isdir(const int *args) {
+  return isdir(args[0]);
+}
+
+static int sys_inumber(const int *args) {
+  return inumber(args[0]);
+}
+
+//~~~~~ Extensions ~~~~~
+static int sys_pread(const int *args) {
+  return pread(args[0], (void *) args[1], args[2], args[3]);
+}
+
+static int sys_pwrite(const int *args) {
+  return pwrite(args[0], (const void *) args[1], args[2], args[3]);
+}
+
+static int sys_readv(const int *args) {
+  return readv(args[0], (const struct iovec *) args[1], args[2]);
+}
+
+static int sys_writev(const int *args) {
+  return writev(args[0], (const struct iovec *) args[1], args[2]);
+}
+
+static int sys_copy_file_range(const int *args) {
+  return copy_file_range(args[0], args[1], args[2]);
+}
+
+static int sys_uring_setup(const int *args) {
+  return uring_setup((struct uring *) args[0]);
+}
+
+static int sys_uring_enter(const int *args) {
+  return uring_enter(args[0]);
+}
+
+/* Handler, argument count, and name for each system call, indexed by
+   number, and whether it uses the fd table or changes the working
+   directory, which a process's uring worker may also be using. Numbers without a handler are invalid */
+static const struct syscall_desc {
+  syscall_func *func;
+  int arg_cnt;
+  const char *name;
+  bool uses_fds;
+} syscall_table[SYS_CNT] = {
+  [SYS_HALT]     = {sys_halt, 0, "halt", false},
+  [SYS_EXIT]     = {sys_exit, 1, "exit", false},
+  [SYS_EXEC]     = {sys_exec, 1, "exec", false},
+  [SYS_WAIT]     = {sys_wait, 1, "wait", false},
+  [SYS_CREATE]   = {sys_create, 2, "create", false},
+  [SYS_REMOVE]   = {sys_remove, 1, "remove", false},
+  [SYS_OPEN]     = {sys_open, 1, "open", true},
+  [SYS_FILESIZE] = {sys_filesize, 1, "filesize", true},
+  [SYS_READ]     = {sys_read, 3, "read", true},
+  [SYS_WRITE]    = {sys_write, 3, "write", true},
+  [SYS_SEEK]     = {sys_seek, 2, "seek", true},
+  [SYS_TELL]     = {sys_tell, 1, "tell", true},
+  [SYS_CLOSE]    = {sys_close, 1, "close", true},
+  [SYS_MKDIR]    = {sys_mkdir, 1, "mkdir", false},
+  [SYS_CHDIR]    = {sys_chdir, 1, "chdir", true},
+  [SYS_READDIR]  = {sys_readdir, 2, "readdir", true},
+  [SYS_ISDIR]    = {sys_isdir, 1, "isdir", true},
+  [SYS_INUMBER]  = {sys_inumber, 1, "inumber", true},
+  [SYS_PREAD]    = {sys_pread, 4, "pread", true},
+  [SYS_PWRITE]   = {sys_pwrite, 4, "pwrite", true},
+  [SYS_READV]    = {sys_readv, 3, "readv", true},
+  [SYS_WRITEV]   = {sys_writev, 3, "writev", true},
+  [SYS_COPY_FILE_RANGE] = {sys_copy_file_range, 3, "copy_file_range", true},
+  [SYS_URING_SETUP] = {sys_uring_setup, 1, "uring_setup", false},
+  [SYS_URING_ENTER] = {sys_uring_enter, 1, "uring_enter", false},
+};
+
+/* Return the name of system call nr, for tracing */
+const char *syscall_name(int nr) {
+  if (nr < 0 || nr >= SYS_CNT || syscall_table[nr].name == NULL) {
+    return "unknown";
+  }
+  return syscall_table[nr].name;
+}
+
+/* Run the system call whose number and arguments are on the user stack
+   at stack_p and return its result. Both the int $0x30 handler and the
+   SYSENTER entry path in sysenter.S come here. Exits the process on a
+   bad stack pointer or an invalid system call number */
+int syscall_dispatch(const int *stack_p) {
+  int syscall_funct;
+  int args[SYSCALL_MAX_ARGS];
+
+  // Copy in the system call number. A bad stack pointer faults inside
+  // copy_from_user() and is caught there instead of being checked up front
+  if (!copy_from_user(&syscall_funct, stack_p, sizeof syscall_funct)) {
+    debug_printf("syscall_dispatch(): Invalid call stack ptr\n");
     exit(-1);
-    return;
-  }
-
-  // Dereference the stack pointer into the system call function number
-  int syscall_funct = *stack_p;
-
-  switch (syscall_funct) {
-
-  //~~~~~ Project 2 system calls ~~~~~
-  // Case 1: halt the operating system
-    case SYS_HALT:
-      debug_printf("(syscall) syscall_funct is [SYS_HALT]\n");
-      halt();
-      break;
-      
-	  // Case 2: terminate this process
-	  case SYS_EXIT: 
-      debug_printf("(syscall) syscall_funct is [SYS_EXIT]\n");
-      //if(!valid_addr(stack_p+1)) {exit(-1);}
-      exit(*(stack_p+1));
-      debug_printf("(syscall) syscall_funct is [SYS_EXIT] complete\n");
-      break; 
-	  
-	  // Case 3: Start another process
-	  case SYS_EXEC: 
-      debug_printf("(syscall) syscall_funct is [SYS_EXEC]\n");
-      if(!valid_addr((stack_p + 1)) || !valid_str(*(stack_p + 1))) {exit(-1);}
-      f->eax = exec(*(stack_p + 1));
-      break; 
-
-	  // Case 4: Wait for a child process to die
-	  case SYS_WAIT: 
-      //if(!valid_add()) {exit(-1);}
-      debug_printf("(syscall) syscall_funct is [SYS_WAIT]\n");
-      if(!valid_addr(stack_p+1)) {exit(-1);}
-      f->eax = wait(*(stack_p+1));
-      break; 
-
-	  // Case 5: Create a file
-	  case SYS_CREATE: 
-      debug_printf("(syscall) syscall_funct is [SYS_CREATE]\n");
-      if(!valid_addr(stack_p+1) || !valid_addr(stack_p+2)) 
-      {exit(-1);}
-      if(!valid_addr(*(stack_p+1))){exit(-1);}
-      debug_printf("s1:%s,s2:%u\n", *(stack_p+1), *(stack_p+2));
-      char *file = *(stack_p+1);
-      unsigned size = *(stack_p+2);
-      
-      f->eax = create((const char * ) file,size);
-      break; 
-
-	  // Case 6: Delete a file
-	  case SYS_REMOVE: 
-       //if(!valid_add()) {exit(-1);}
-      debug_printf("(syscall) syscall_funct is [SYS_REMOVE]\n");
-      f->eax = remove(*(stack_p+1));
-      break; 
-
-	  // Case 7: Open a file 
-	  case SYS_OPEN: 
-      debug_printf("(syscall) syscall_funct is [SYS_OPEN]\n");
-      if(!valid_addr(stack_p+1) | !valid_addr(*(stack_p+1)) ){exit(-1);}
-      file = *(stack_p+1);
-      f->eax = open(file);
-      break; 
-
-	  // Case 8: Obtain a files size
-	  case SYS_FILESIZE:
-       //if(!valid_add()) {exit(-1);}
-      debug_printf("(syscall) syscall_funct is [SYS_FILESIZE]\n");
-      f->eax = filesize(*(stack_p + 1));
-      break; 
-
-	  // Case 9: Read from a file 
-	  case SYS_READ:
-       //if(!valid_add()) {exit(-1);}
-      debug_printf("(syscall) syscall_funct is [SYS_READ]\n");
-      if (!valid_addr((stack_p+1))  || !valid_addr((stack_p+2))  
-          || !valid_addr((stack_p+3))){exit(-1);}
-      debug_printf("s1:%u,s2:%u,s3:%u\n", *(stack_p+1), *(stack_p+2), *(stack_p+3));
-      int fd = *(stack_p+1);
-      void * buf = *(stack_p+2);
-      unsigned sz = *(stack_p+3);
-
-      if (!valid_str(buf)) {
-        exit(-1);
-      }
-
-      f->eax = read(fd, buf, sz);
-      break; 
-
-	  // Case 10: Write to a file 
-	  case SYS_WRITE: 
-       //if(!valid_add()) {exit(-1);}
-      debug_printf("(syscall) syscall_funct is [SYS_WRITE]\n");
-      if (!valid_addr((stack_p+1)) || !valid_addr((stack_p+2))  
-          || !valid_addr((stack_p+3)) || !valid_addr(*(stack_p+2))) {exit(-1);}
-      // if (!valid_addr(*(stack_p+5)))
-      //     {exit(-1);}
-      debug_printf("s1:%u,s2:%u,s3:%u\n", *(stack_p+1), *(stack_p+2), *(stack_p+3));
-      debug_printf("s1:%d,s2:%d,s3:%d\n", (size_t)*(stack_p+1), (size_t)*(stack_p+2), (size_t)*(stack_p+3));
-      fd = *(stack_p+1);
-      buf = *(stack_p+2);
-      sz = *(stack_p+3);
-      f->eax = write(fd, buf, sz);
-      break; 
-
-	  // Case 11: Change a position in a file
-	  case SYS_SEEK: 
-       //if(!valid_add()) {exit(-1);}
-      debug_printf("(syscall) syscall_funct is [SYS_SEEK]\n");
-      if (!valid_addr((stack_p+2)) || !valid_addr((stack_p+2))) exit (-1);
-      
-      seek(*(stack_p+1),*(stack_p+2));
-      break; 
-
-	  // Case 12: Report a current position in a file
-	  case SYS_TELL:
-       //if(!valid_add()) {exit(-1);}
-      tell(*(stack_p + 1));
-      debug_printf("(syscall) syscall_funct is [SYS_TELL]\n"); 
-      break; 
-
-	  // Case 13: Close a file
-	  case SYS_CLOSE: 
-      //if(!valid_add()) {exit(-1);}
-      if(!valid_addr(stack_p+1)){exit(-1);}
-      file = *(stack_p+1);
-      close(file);
-
-      debug_printf("(syscall) syscall_funct is [SYS_CLOSE]\n");
-      break; 
-
-	  // Case 14: Create a directory
-    case SYS_MKDIR:
-      debug_printf("(syscall) syscall_funct is [SYS_MKDIR]\n");
-      if (!valid_addr(stack_p + 1) || !valid_str(*(stack_p + 1))) { exit(-1); }
-      f->eax = mkdir(*(stack_p + 1));
-      break;
-
-    // Case 15: Change the current working directory
-    case SYS_CHDIR:
-      debug_printf("(syscall) syscall_funct is [SYS_CHDIR]\n");
-      if (!valid_addr(stack_p + 1) || !valid_str(*(stack_p + 1))) { exit(-1); }
-      f->eax = chdir(*(stack_p + 1));
-      break;
-
-    // Case 16: Read a directory entry
-    case SYS_READDIR:
-      debug_printf("(syscall) syscall_funct is [SYS_READDIR]\n");
-      if (!valid_addr(stack_p + 1) || !valid_addr(stack_p + 2) || !valid_addr(*(stack_p + 2))) { exit(-1); }
-      f->eax = readdir(*(stack_p + 1), *(stack_p + 2));
-      break;
-
-    // Case 17: Check if fd represents a directory
-    case SYS_ISDIR:
-      debug_printf("(syscall) syscall_funct is [SYS_ISDIR]\n");
-      if (!valid_addr(stack_p + 1)) { exit(-1); }
-      f->eax = isdir(*(stack_p + 1));
-      break;
-
-    // Case 18: Get inode number for a file or directory
-    case SYS_INUMBER:
-      debug_printf("(syscall) syscall_funct is [SYS_INUMBER]\n");
-      if (!valid_addr(stack_p + 1)) { exit(-1); }
-      f->eax = inumber(*(stack_p + 1));
-      break;
-
-    //~~~~~ Project 2 System Calls ~~~~~
-    // Default to exiting the process 
-    default: 
-      debug_printf("(syscall) syscall_funct is DEFAULT [SYS_EXIT]\n");
-      exit(-1);
-      break; 
   }
+  debug_printf("(syscall_dispatch) Stack pointer : 0x%x and funct [%d]\n",
+      (uintptr_t) stack_p, syscall_funct);
+
+  if (syscall_funct < 0 || syscall_funct >= SYS_CNT
+      || syscall_table[syscall_funct].func == NULL) {
+    debug_printf("(syscall_dispatch) invalid syscall [%d]\n", syscall_funct);
+    exit(-1);
+  }
+
+  const struct syscall_desc *desc = &syscall_table[syscall_funct];
+  get_args(stack_p, args, desc->arg_cnt);
+
+  // Keep the process's uring worker out of the fd table meanwhile
+  bool lock_fds = desc->uses_fds && thread_current()->uring != NULL;
+  if (lock_fds) {
+    uring_lock_fds();
+  }
+
+  int result;
+  if (!strace_enabled) {
+    result = desc->func(args);
+  } else {
+    // Time the call for the tracer
+    uint64_t start = timer_cycles();
+    result = desc->func(args);
+    strace_record(syscall_funct, args, desc->arg_cnt, result, timer_cycles() - start);
+  }
+
+  if (lock_fds) {
+    uring_unlock_fds();
+  }
+  return result;
+}
+
+static void syscall_handler(struct intr_frame *f) {
+  f->eax = syscall_dispatch(f->esp);
 }
 
 void halt(void) {
@@ -329,11 +374,8 @@ bool create(const char *file, unsigned initial_size) {
     return -1;
   }
 
-  // using locks to prevent race conditions
-  debug_printf("create(): attempting to acquire file lock\n");
-  lock_acquire(&file_lock);
+  // The file system locks the directories and free map it touches
   int result = filesys_create(file, initial_size, 0); // return 0 for is_dir
-  lock_release(&file_lock);
   debug_printf("create(): result = %d!\n", result); 
   
   return result;
@@ -346,61 +388,147 @@ bool remove(const char *file) {
     return -1;
   }
 
-  lock_acquire(&file_lock);
   bool result = filesys_remove(file);
   debug_printf("remove(): result removing[%d]! \n", result);
-  lock_release(&file_lock);
   return result;
 }
 
 
-struct file_inst *locate_file (int fd) {
-  // get current thread
-  struct thread * cur = thread_current();
-  struct list_elem * list_e;
+/* Return the file open as fd, or NULL if fd is not open. The fd indexes
+   the thread's fd table directly so this takes constant time */
+struct file *locate_file (int fd) {
+  return fd_lookup(thread_current(), fd);
+}
+
+/* Return the file open as fd if it may be written, or NULL if fd is not
+   open or is a directory, whose entries change only under its own lock */
+static struct file *locate_writable(int fd) {
+  struct file *file_p = locate_file(fd);
+  if (file_p == NULL || inode_is_dir(file_get_inode(file_p))) {
+    return NULL;
+  }
+  return file_p;
+}
+
+/* Return the file open as fd in thread t, or NULL if fd is not open */
+struct file *fd_lookup(struct thread *t, int fd) {
+  if (fd < FD_MIN || fd >= t->fd_cap) {
+    debug_printf("fd_lookup(): returned NULL!\n");
+    return NULL;
+  }
+  return t->fd_table[fd];
+}
+
+/* Install file_p as the lowest free fd of thread t, growing the fd table
+   if it is full. Returns the fd or -1 if out of memory */
+int fd_alloc(struct thread *t, struct file *file_p) {
+  int fd = t->fd_next;
 
-  // iterate through list of files until locate correct file descriptor element
-  for (list_e = list_begin(&cur->list_files); list_e != list_end(&cur->list_files); list_e = list_next(list_e)) {
-    struct file_inst * fd_e = list_entry(list_e, struct file_inst, file_list_e);
-    if (fd_e->fd == fd) {
-      return fd_e;
+  // Every fd below fd_next is in use, so search from there
+  while (fd < t->fd_cap && t->fd_table[fd] != NULL) {
+    fd++;
+  }
+  if (fd == t->fd_cap) {
+    // Table is full: double its size
+    int new_cap = t->fd_cap == 0 ? FD_TABLE_INIT : t->fd_cap * 2;
+    struct file **table = realloc(t->fd_table, new_cap * sizeof *table);
+    if (table == NULL) {
+      return -1;
     }
+    memset(table + t->fd_cap, 0, (new_cap - t->fd_cap) * sizeof *table);
+    t->fd_table = table;
+    t->fd_cap = new_cap;
   }
 
-  debug_printf("locate_file(): returned NULL!\n");
+  t->fd_table[fd] = file_p;
+  t->fd_next = fd + 1;
+  return fd;
+}
 
-  return NULL;
+/* Mark fd, which must be open in thread t, as free for reuse */
+void fd_free(struct thread *t, int fd) {
+  t->fd_table[fd] = NULL;
+  if (fd < t->fd_next) {
+    t->fd_next = fd;
+  }
 }
 
 int open(const char *file) {
   // Opens the file, returning non-negative integer, -1, or the fd
   debug_printf("(open) Opening file [%s]\n", file);
-  lock_acquire(&file_lock);
   struct file *file_p = filesys_open(file);
-  lock_release(&file_lock);
   // Return if we failed to open the file
   if (file_p == NULL) {
     debug_printf("(open) failed to open file\n");
     return -1;
   }
 
-   // Allocate memory for new file element and instantiate the struct
-    debug_printf("(open) allocating memory\n");
-    struct file_inst *file_elem = malloc(sizeof(struct file_inst));
-    if (file_elem == NULL) {
-        // Close and return if we failed to allocate
-        file_close(file_p); 
-        return -1;
-    }
-  debug_printf("(open) initializing element\n");
-  // Initialize file element
-  file_elem->fd = ++thread_current()->fd_ct;
-  file_elem->file_p = file_p;
-  // Insert the file elements
-  debug_printf("(open) inserting item\n");
-  list_push_front(&thread_current()->list_files,&file_elem->file_list_e);
+  // Give the file the lowest free file descriptor
+  int fd = fd_alloc(thread_current(), file_p);
+  if (fd == -1) {
+    // Close and return if we failed to allocate
+    lock_acquire(&file_lock);
+    file_close(file_p);
+    lock_release(&file_lock);
+    return -1;
+  }
   debug_printf("(open) Finished\n");
-  return file_elem->fd;
+  return fd;
+}
+
+/* Move size bytes between the open file file_p and the user buffer ubuf:
+   from the file into ubuf, or from ubuf into the file if write is true.
+   Data goes a page at a time through the kernel page kbuf, so that a bad
+   user buffer faults in copy_to_user() or copy_from_user(), where it is
+   caught, rather than inside the file system. If ofs is NULL the transfer
+   uses and advances the file position, otherwise it starts at *ofs and
+   advances that instead. Returns the number of bytes moved, which is short
+   only at end of file. On a bad user buffer, frees kbuf and exits */
+static unsigned file_transfer(struct file *file_p, void *ubuf, unsigned size,
+                              off_t *ofs, bool write, uint8_t *kbuf) {
+  unsigned total = 0;
+  while (total < size) {
+    unsigned chunk = size - total < PGSIZE ? size - total : PGSIZE;
+    uint8_t *uaddr = (uint8_t *) ubuf + total;
+    int result;
+
+    if (write && !copy_from_user(kbuf, uaddr, chunk)) {
+      palloc_free_page(kbuf);
+      exit(-1);
+    }
+    lock_acquire(&file_lock);
+    if (ofs == NULL) {
+      result = write ? file_write(file_p, kbuf, chunk) : file_read(file_p, kbuf, chunk);
+    } else {
+      result = write ? file_write_at(file_p, kbuf, chunk, *ofs) : file_read_at(file_p, kbuf, chunk, *ofs);
+      *ofs += result;
+    }
+    lock_release(&file_lock);
+    if (!write && !copy_to_user(uaddr, kbuf, result)) {
+      palloc_free_page(kbuf);
+      exit(-1);
+    }
+    total += result;
+    if ((unsigned) result < chunk) break;  // end of file
+  }
+  return total;
+}
+
+/* Write size bytes from the user buffer ubuf to the console, a page at a
+   time through the kernel page kbuf. On a bad user buffer, frees kbuf and
+   exits */
+static unsigned console_write(const void *ubuf, unsigned size, uint8_t *kbuf) {
+  unsigned total = 0;
+  while (total < size) {
+    unsigned chunk = size - total < PGSIZE ? size - total : PGSIZE;
+    if (!copy_from_user(kbuf, (const uint8_t *) ubuf + total, chunk)) {
+      palloc_free_page(kbuf);
+      exit(-1);
+    }
+    putbuf((const char *) kbuf, chunk);
+    total += chunk;
+  }
+  return total;
 }
 
 int read(int fd, void *buffer, unsigned size) {
@@ -418,13 +546,13 @@ int read(int fd, void *buffer, unsigned size) {
   }
 
   // locate file
-  struct file_inst * fd_e = locate_file(fd);
-  if (fd_e == NULL) exit(-1);
+  struct file * file_p = locate_file(fd);
+  if (file_p == NULL) exit(-1);
 
-  // read file
-  lock_acquire(&file_lock);
-  int result = file_read(fd_e->file_p, buffer, size);
-  lock_release(&file_lock);
+  uint8_t *kbuf = palloc_get_page(0);
+  if (kbuf == NULL) return -1;
+  unsigned result = file_transfer(file_p, buffer, size, NULL, false, kbuf);
+  palloc_free_page(kbuf);
 
   return result;
 }
@@ -435,23 +563,24 @@ int write(int fd, const void *buffer, unsigned size) {
 
   // Check if console out, as fd = 1 for console writes.
   debug_printf("(write) fd:%d\n", fd);
-  if (fd == STDOUT_FILENO) {
-    putbuf(buffer, size);
-    return size;
+  struct file * file_p = NULL;
+  if (fd != STDOUT_FILENO) {
+    file_p = locate_writable(fd);
+    if (file_p == NULL) {
+      debug_printf("(write) file_p NULL!\n");
+      return -1;
+    }
   }
-  debug_printf("(write) fd:%d Done\n", fd);
-
-  struct file_inst * fd_e = locate_file(fd);
 
-  if (fd_e == NULL) {
-    return -1;
-    debug_printf("(write) fd_e NULL!\n");
+  uint8_t *kbuf = palloc_get_page(0);
+  if (kbuf == NULL) return -1;
+  unsigned result;
+  if (file_p == NULL) {
+    result = console_write(buffer, size, kbuf);
+  } else {
+    result = file_transfer(file_p, (void *) buffer, size, NULL, true, kbuf);
   }
-
-  lock_acquire(&file_lock);
-  // write to the file
-  int result = file_write(fd_e->file_p, buffer, size);
-  lock_release(&file_lock);
+  palloc_free_page(kbuf);
 
   debug_printf("(write) result:%d\n", result);
 
@@ -459,35 +588,104 @@ int write(int fd, const void *buffer, unsigned size) {
 
 }
 
+/* Read size bytes from fd into buffer starting at byte offset in the
+   file, without using or changing the file position */
+int pread(int fd, void *buffer, unsigned size, unsigned offset) {
+  struct file *file_p = locate_file(fd);
+  off_t ofs = offset;
+  if (file_p == NULL || ofs < 0) return -1;
+
+  uint8_t *kbuf = palloc_get_page(0);
+  if (kbuf == NULL) return -1;
+  unsigned result = file_transfer(file_p, buffer, size, &ofs, false, kbuf);
+  palloc_free_page(kbuf);
+  return result;
+}
+
+/* Write size bytes from buffer to fd starting at byte offset in the file,
+   without using or changing the file position */
+int pwrite(int fd, const void *buffer, unsigned size, unsigned offset) {
+  struct file *file_p = locate_writable(fd);
+  off_t ofs = offset;
+  if (file_p == NULL || ofs < 0) return -1;
+
+  uint8_t *kbuf = palloc_get_page(0);
+  if (kbuf == NULL) return -1;
+  unsigned result = file_transfer(file_p, (void *) buffer, size, &ofs, true, kbuf);
+  palloc_free_page(kbuf);
+  return result;
+}
+
+/* Read from fd into each of the iovcnt user buffers described by the user
+   array iov in turn, or write from them to fd if write is true, all in one
+   system call. Stops early at end of file */
+static int vector_transfer(int fd, const struct iovec *iov, int iovcnt, bool write) {
+  struct file *file_p = NULL;
+  if (iovcnt < 0 || iovcnt > IOV_MAX) return -1;
+  if (!write || fd != STDOUT_FILENO) {
+    file_p = write ? locate_writable(fd) : locate_file(fd);
+    if (file_p == NULL) return -1;
+  }
+
+  uint8_t *kbuf = palloc_get_page(0);
+  if (kbuf == NULL) return -1;
+  int total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    // Copy in one segment descriptor at a time
+    struct iovec seg;
+    if (!copy_from_user(&seg, &iov[i], sizeof seg)) {
+      palloc_free_page(kbuf);
+      exit(-1);
+    }
+    unsigned result;
+    if (file_p == NULL) {
+      result = console_write(seg.iov_base, seg.iov_len, kbuf);
+    } else {
+      result = file_transfer(file_p, seg.iov_base, seg.iov_len, NULL, write, kbuf);
+    }
+    total += result;
+    if (result < seg.iov_len) break;  // end of file
+  }
+  palloc_free_page(kbuf);
+  return total;
+}
+
+int readv(int fd, const struct iovec *iov, int iovcnt) {
+  return vector_transfer(fd, iov, iovcnt, false);
+}
+
+int writev(int fd, const struct iovec *iov, int iovcnt) {
+  return vector_transfer(fd, iov, iovcnt, true);
+}
 
 void seek (int fd, unsigned position) {
-  struct file_inst * file_elem = locate_file(fd);
-  if (file_elem == NULL) exit(-1);
+  struct file * file_p = locate_file(fd);
+  if (file_p == NULL) exit(-1);
 
   // using seek function
   lock_acquire(&file_lock);
-  file_seek(file_elem->file_p, position);
+  file_seek(file_p, position);
   lock_release(&file_lock);
 }
 
 int filesize(int fd) {
-  struct file_inst * file_elem = locate_file(fd);
-  if (file_elem == NULL) exit(-1);
+  struct file * file_p = locate_file(fd);
+  if (file_p == NULL) exit(-1);
 
   // using length function
   lock_acquire(&file_lock);
-  int result = file_length(file_elem->file_p);
+  int result = file_length(file_p);
   lock_release(&file_lock);
   return result;
 }
 
 unsigned tell (int fd) {
-  struct file_inst * file_elem = locate_file(fd);
-  if (file_elem == NULL) exit(-1);
+  struct file * file_p = locate_file(fd);
+  if (file_p == NULL) exit(-1);
 
   // using tell function
   lock_acquire(&file_lock);
-  unsigned result = file_tell(file_elem->file_p);
+  unsigned result = file_tell(file_p);
   lock_release(&file_lock);
   return result;
 }
@@ -497,58 +695,73 @@ void close (int fd) {
   if (fd == STDIN_FILENO || fd == STDOUT_FILENO) return;
 
   // locate file
-  struct file_inst * fd_e = locate_file(fd);
-  if (fd_e == NULL) exit(-1);
+  struct file * file_p = locate_file(fd);
+  if (file_p == NULL) exit(-1);
 
-  // read file
+  // close file
   lock_acquire(&file_lock);
-  int result = file_close(fd_e->file_p);
+  file_close(file_p);
   lock_release(&file_lock);
 
-  // Now remove file descriptor elemenet
-  list_remove(&fd_e->file_list_e);
-  free(fd_e);
+  // Now free the file descriptor for reuse
+  fd_free(thread_current(), fd);
   debug_printf("close(): finished!");
 
 }
 
+/* Close every file the current process has open and free its fd table */
+void close_all_files(void) {
+  struct thread *cur = thread_current();
+
+  lock_acquire(&file_lock);
+  for (int fd = FD_MIN; fd < cur->fd_cap; fd++) {
+    if (cur->fd_table[fd] != NULL) {
+      file_close(cur->fd_table[fd]);
+    }
+  }
+  lock_release(&file_lock);
+
+  free(cur->fd_table);
+  cur->fd_table = NULL;
+  cur->fd_cap = 0;
+  cur->fd_next = FD_MIN;
+}
+
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 // Directory system calls
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* create a directory named dir*/
 /* Create a directory named dir */
 bool mkdir(const char *dir) {
-  bool success;
-
-  lock_acquire(&file_lock);
-  success = filesys_create(dir, 0, true);
-  lock_release(&file_lock);
-
-  return success;
+  return filesys_create(dir, 0, true);
 }
 
-/* Read a directory entry from fd */
+/* Read a directory entry from fd into the user buffer name */
 bool readdir(int fd, char *name) {
-  struct file_inst *file_inst = locate_file(fd);
-  struct dir *dir = (struct dir *) file_inst->file_p;
+  struct dir *dir = (struct dir *) locate_file(fd);
+  char kname[NAME_MAX + 1];
 
   if (!inode_is_dir(dir_get_inode(dir))) {
     return false;
   }
 
-  return dir_readdir(dir, name);
+  if (!dir_readdir(dir, kname)) {
+    return false;
+  }
+  if (!copy_to_user(name, kname, strlen(kname) + 1)) {
+    exit(-1);
+  }
+  return true;
 }
 
 /* Return true if fd represents a directory or false if it doesn't */
 bool isdir(int fd) {
-  struct file_inst *file_inst = locate_file(fd);
-  return inode_is_dir(file_get_inode(file_inst->file_p));
+  return inode_is_dir(file_get_inode(locate_file(fd)));
 }
 
 /* Return the inode number of the inode associated with fd (can be file or directory) */
 int inumber(int fd) {
-  struct file_inst *file_inst = locate_file(fd);
-  return inode_get_inumber(file_get_inode(file_inst->file_p));
+  return inode_get_inumber(file_get_inode(locate_file(fd)));
 }
 
 /* Change the current working directory */
@@ -562,4 +775,40 @@ bool chdir(const char *dir) {
   dir_close(thread_current()->cwd);
   thread_current()->cwd = new_dir;
   return true;
-}
\ No newline at end of file
+}
+
+/* Copy length bytes from fd_in to fd_out, starting at and advancing each
+   file's position. The data moves between buffer cache blocks, or for the
+   console through one kernel page, and never through user memory. Returns
+   the number of bytes copied, short only at end of file, or -1 for a bad
+   fd or overlapping ranges of the same file */
+int copy_file_range(int fd_in, int fd_out, unsigned length) {
+  struct file *in = locate_file(fd_in);
+  if (in == NULL) return -1;
+  off_t size = length < INT32_MAX ? (off_t) length : INT32_MAX;
+  int result;
+
+  if (fd_out == STDOUT_FILENO) {
+    uint8_t *kbuf = palloc_get_page(0);
+    if (kbuf == NULL) return -1;
+    result = 0;
+    while (result < size) {
+      off_t chunk = size - result < PGSIZE ? size - result : PGSIZE;
+      lock_acquire(&file_lock);
+      off_t bytes_read = file_read(in, kbuf, chunk);
+      lock_release(&file_lock);
+      putbuf((const char *) kbuf, bytes_read);
+      result += bytes_read;
+      if (bytes_read < chunk) break;  // end of file
+    }
+    palloc_free_page(kbuf);
+    return result;
+  }
+
+  struct file *out = locate_writable(fd_out);
+  if (out == NULL) return -1;
+  lock_acquire(&file_lock);
+  result = file_copy(out, in, size);
+  lock_release(&file_lock);
+  return result;
+}
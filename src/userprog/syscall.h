@@ -3,22 +3,15 @@
 
 #include "threads/synch.h"
 #include <debug.h>
+#include <iovec.h>
 #include <stdbool.h>
 
 void syscall_init(void);
+int syscall_dispatch(const int *stack_p);
+const char *syscall_name(int nr);
 
 typedef int pid_t;
 
-struct file_inst
-{
-  // set file pointer
-  struct file * file_p;
-  // file descriptor
-  int fd;
-  // list element
-  struct list_elem file_list_e;
-};
-
 /** Projects 2 and later. */
 struct lock file_lock;
 struct lock process_lock;
@@ -42,4 +35,19 @@ bool readdir (int fd, char *name);
 bool isdir(int fd);
 int inumber(int fd);
 bool chdir (const char *dir);
+// Positional and scatter/gather I/O
+int pread(int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite(int fd, const void *buffer, unsigned length, unsigned offset);
+int readv(int fd, const struct iovec *iov, int iovcnt);
+int writev(int fd, const struct iovec *iov, int iovcnt);
+// In-kernel copy between files
+int copy_file_range(int fd_in, int fd_out, unsigned length);
+// Close every file the current process has open
+void close_all_files(void);
+// File descriptor tables, also used on a process's behalf by its uring
+struct thread;
+struct file *locate_file(int fd);
+struct file *fd_lookup(struct thread *t, int fd);
+int fd_alloc(struct thread *t, struct file *file_p);
+void fd_free(struct thread *t, int fd);
 #endif /**< userprog/syscall.h */
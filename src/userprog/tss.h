@@ -7,5 +7,6 @@ struct tss;
 void tss_init (void);
 struct tss *tss_get (void);
 void tss_update (void);
+void **tss_esp0 (void);
 
 #endif /**< userprog/tss.h */
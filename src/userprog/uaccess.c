@@ -0,0 +1,126 @@
+#include "userprog/uaccess.h"
+#include "threads/vaddr.h"
+
+/** Kernel access to user memory.
+
+   Rather than checking each user address against the page
+   directory before using it, these functions just access user
+   memory and let an unmapped address cause a page fault.  Each
+   instruction that may fault this way is listed in the exception
+   table, along with the address of code that recovers from the
+   fault.  page_fault() looks up the faulting instruction with
+   uaccess_fixup() and, if it is there, resumes at the recovery
+   code instead of killing the process.
+
+   Only the range check against PHYS_BASE is done up front, since
+   kernel memory is always mapped and so would never fault. */
+
+/** An exception table entry. */
+struct ex_entry
+  {
+    uintptr_t insn;             /**< Instruction that may fault. */
+    uintptr_t fixup;            /**< Where to resume if it does. */
+  };
+
+/** Exception table, gathered from the __ex_table sections of all
+   object files by the linker script. */
+extern const struct ex_entry _start_ex_table[], _end_ex_table[];
+
+/** Returns true if the SIZE bytes starting at UADDR are all below
+   PHYS_BASE. */
+static bool
+is_user_range (const void *uaddr, size_t size)
+{
+  uintptr_t addr = (uintptr_t) uaddr;
+  return addr <= (uintptr_t) PHYS_BASE
+         && size <= (uintptr_t) PHYS_BASE - addr;
+}
+
+/** Copies SIZE bytes from SRC to DST, either of which may be in
+   user memory.  Returns the number of bytes not copied, which is
+   nonzero only if a page fault cut the copy short. */
+static size_t
+copy_user (void *dst, const void *src, size_t size)
+{
+  /* On a fault, the CPU leaves ECX counting the bytes that "rep
+     movsb" has not yet moved. */
+  asm volatile ("1: rep movsb\n"
+                "2:\n"
+                ".section __ex_table, \"a\"\n"
+                "   .long 1b, 2b\n"
+                ".previous"
+                : "+c" (size), "+D" (dst), "+S" (src)
+                : : "memory");
+  return size;
+}
+
+/** Copies SIZE bytes from user address USRC to kernel address
+   DST.  Returns true if successful, false if USRC is not all
+   mapped user memory, in which case DST may be partly
+   written. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  return is_user_range (usrc, size) && copy_user (dst, usrc, size) == 0;
+}
+
+/** Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Returns true if successful, false if UDST is not all
+   mapped user memory, in which case UDST may be partly
+   written. */
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  return is_user_range (udst, size) && copy_user (udst, src, size) == 0;
+}
+
+/** Copies the null-terminated string at user address USRC into
+   kernel buffer DST, which has room for SIZE bytes including the
+   null terminator.  Returns true if successful, false if the
+   string is not all in mapped user memory or does not fit. */
+bool
+copy_str_from_user (char *dst, const char *usrc, size_t size)
+{
+  size_t left;
+  int faulted = 0;
+  int last = 1;
+
+  /* The string must end before PHYS_BASE. */
+  if (!is_user_range (usrc, 0))
+    return false;
+  left = (uintptr_t) PHYS_BASE - (uintptr_t) usrc;
+  if (left > size)
+    left = size;
+  if (left == 0)
+    return false;
+
+  asm volatile ("1: lodsb\n"
+                "   stosb\n"
+                "   testb %%al, %%al\n"
+                "   jz 3f\n"
+                "   loop 1b\n"
+                "   jmp 3f\n"
+                "2: movl $1, %3\n"
+                "3:\n"
+                ".section __ex_table, \"a\"\n"
+                "   .long 1b, 2b\n"
+                ".previous"
+                : "+S" (usrc), "+D" (dst), "+c" (left), "+rm" (faulted),
+                  "+a" (last)
+                : : "memory", "cc");
+  return !faulted && (last & 0xff) == 0;
+}
+
+/** Returns the address at which to resume after a page fault in
+   the kernel at EIP while accessing user memory, or 0 if EIP is
+   not an instruction that accesses user memory. */
+uintptr_t
+uaccess_fixup (uintptr_t eip)
+{
+  const struct ex_entry *e;
+
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == eip)
+      return e->fixup;
+  return 0;
+}
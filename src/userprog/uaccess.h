@@ -0,0 +1,14 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
+bool copy_str_from_user (char *dst, const char *usrc, size_t size);
+
+uintptr_t uaccess_fixup (uintptr_t eip);
+
+#endif /**< userprog/uaccess.h */
@@ -0,0 +1,441 @@
+#include "userprog/uring.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+
+/** Batched asynchronous I/O through shared rings.
+
+   See lib/uring.h for the interface seen by user processes.  One
+   kernel worker thread, started by the first uring_setup(), runs
+   the operations of every registered process in turn.  It reaches
+   the shared page, the process's buffers, and the process's file
+   descriptors directly, without switching to its page directory:
+   user addresses are translated with pagedir_get_page(), so a bad
+   buffer fails the operation instead of faulting.
+
+   A process's own system calls that use file descriptors or change
+   its working directory hold FD_LOCK, as does the worker while it
+   runs one of that process's operations, so the two never modify
+   the fd table at once and the worker opens relative paths in the
+   process's current working directory.  When
+   the process exits, uring_exit() unregisters it and waits for the
+   worker to finish with it before the fd table and page directory
+   are destroyed. */
+
+/** Operations run from one process before moving to the next. */
+#define URING_BATCH 16
+
+/** Kernel state for one registered process. */
+struct uring_ctx
+  {
+    struct list_elem elem;      /**< Element in `rings'. */
+    struct thread *owner;       /**< Registering process. */
+    uint32_t *pagedir;          /**< Owner's page directory. */
+    struct uring *ring;         /**< Kernel address of shared rings. */
+    unsigned sq_head;           /**< Next submission to run. */
+    unsigned cq_tail;           /**< Next completion slot. */
+    bool pending;               /**< Submissions may be waiting. */
+    bool busy;                  /**< Worker is running operations. */
+    struct lock fd_lock;        /**< Guards the owner's fd table and cwd. */
+    struct condition progress;  /**< Completion posted or worker done. */
+  };
+
+/** Registered processes, in the order the worker visits them,
+   and the worker's state, all protected by RINGS_LOCK. */
+static struct list rings;
+static struct lock rings_lock;
+static struct condition work_ready;
+static bool worker_started;
+
+static thread_func worker;
+static bool run_batch (struct uring_ctx *, uint8_t *kbuf);
+static int run_op (struct uring_ctx *, const struct uring_sqe *,
+                   uint8_t *kbuf);
+
+/** Initializes the uring module. */
+void
+uring_init (void) 
+{
+  ASSERT (sizeof (struct uring) <= PGSIZE);
+  list_init (&rings);
+  lock_init (&rings_lock);
+  cond_init (&work_ready);
+}
+
+/** Registers RING, which must be page-aligned and mapped writable
+   in the running process, as its shared rings.  Returns 0 if
+   successful, -1 on failure or if the process already has
+   rings. */
+int
+uring_setup (struct uring *ring) 
+{
+  struct thread *cur = thread_current ();
+  struct uring_ctx *ctx;
+  struct uring *kring;
+
+  if (cur->uring != NULL || pg_ofs (ring) != 0 || !is_user_vaddr (ring)
+      || !pagedir_is_writable (cur->pagedir, ring))
+    return -1;
+  kring = pagedir_get_page (cur->pagedir, ring);
+  if (kring == NULL)
+    return -1;
+
+  ctx = malloc (sizeof *ctx);
+  if (ctx == NULL)
+    return -1;
+  ctx->owner = cur;
+  ctx->pagedir = cur->pagedir;
+  ctx->ring = kring;
+  ctx->sq_head = ctx->cq_tail = 0;
+  ctx->pending = ctx->busy = false;
+  lock_init (&ctx->fd_lock);
+  cond_init (&ctx->progress);
+  kring->sq_head = kring->sq_tail = 0;
+  kring->cq_head = kring->cq_tail = 0;
+
+  lock_acquire (&rings_lock);
+  if (!worker_started)
+    {
+      if (thread_create ("uring", PRI_DEFAULT, worker, NULL) == TID_ERROR)
+        {
+          lock_release (&rings_lock);
+          free (ctx);
+          return -1;
+        }
+      worker_started = true;
+    }
+  list_push_back (&rings, &ctx->elem);
+  lock_release (&rings_lock);
+
+  cur->uring = ctx;
+  return 0;
+}
+
+/** Returns the number of completions that CTX has posted and its
+   owner has not yet consumed. */
+static unsigned
+completions_ready (struct uring_ctx *ctx) 
+{
+  unsigned ready = ctx->cq_tail - ctx->ring->cq_head;
+  barrier ();
+  return ready <= URING_ENTRIES ? ready : 0;
+}
+
+/** Hands the running process's queued submissions to the worker,
+   then waits until at least MIN_COMPLETE completions are ready or
+   the worker has nothing more it can run.  Returns the number of
+   completions ready, or -1 if the process has no rings. */
+int
+uring_enter (unsigned min_complete) 
+{
+  struct uring_ctx *ctx = thread_current ()->uring;
+  unsigned ready;
+
+  if (ctx == NULL)
+    return -1;
+  if (min_complete > URING_ENTRIES)
+    min_complete = URING_ENTRIES;
+
+  lock_acquire (&rings_lock);
+  ctx->pending = true;
+  cond_signal (&work_ready, &rings_lock);
+  while ((ready = completions_ready (ctx)) < min_complete
+         && (ctx->pending || ctx->busy))
+    cond_wait (&ctx->progress, &rings_lock);
+  lock_release (&rings_lock);
+
+  return ready;
+}
+
+/** Acquires the running process's fd table lock, if it has rings.
+   Held across each system call that uses file descriptors or
+   changes the working directory. */
+void
+uring_lock_fds (void) 
+{
+  struct uring_ctx *ctx = thread_current ()->uring;
+  if (ctx != NULL)
+    lock_acquire (&ctx->fd_lock);
+}
+
+/** Releases the lock taken by uring_lock_fds(). */
+void
+uring_unlock_fds (void) 
+{
+  struct uring_ctx *ctx = thread_current ()->uring;
+  if (ctx != NULL)
+    lock_release (&ctx->fd_lock);
+}
+
+/** Unregisters the running process's rings, if any, once the
+   worker is done with them.  Called by process_exit() before it
+   closes the process's files and destroys its page directory. */
+void
+uring_exit (void) 
+{
+  struct thread *cur = thread_current ();
+  struct uring_ctx *ctx = cur->uring;
+
+  if (ctx == NULL)
+    return;
+
+  /* The process may be exiting from inside a system call. */
+  if (lock_held_by_current_thread (&ctx->fd_lock))
+    lock_release (&ctx->fd_lock);
+
+  lock_acquire (&rings_lock);
+  list_remove (&ctx->elem);
+  while (ctx->busy)
+    cond_wait (&ctx->progress, &rings_lock);
+  lock_release (&rings_lock);
+
+  cur->uring = NULL;
+  free (ctx);
+}
+
+/** Worker thread.  Repeatedly picks the first process with
+   pending submissions, runs a batch of them, and moves it to the
+   back of the list. */
+static void
+worker (void *aux UNUSED) 
+{
+  uint8_t *kbuf = palloc_get_page (PAL_ASSERT);
+
+  lock_acquire (&rings_lock);
+  for (;;) 
+    {
+      struct uring_ctx *ctx = NULL;
+      struct list_elem *e;
+      bool more;
+
+      for (e = list_begin (&rings); e != list_end (&rings);
+           e = list_next (e))
+        if (list_entry (e, struct uring_ctx, elem)->pending)
+          {
+            ctx = list_entry (e, struct uring_ctx, elem);
+            break;
+          }
+      if (ctx == NULL)
+        {
+          cond_wait (&work_ready, &rings_lock);
+          continue;
+        }
+
+      list_remove (&ctx->elem);
+      list_push_back (&rings, &ctx->elem);
+      ctx->pending = false;
+      ctx->busy = true;
+      lock_release (&rings_lock);
+
+      more = run_batch (ctx, kbuf);
+
+      lock_acquire (&rings_lock);
+      ctx->busy = false;
+      ctx->pending = more;
+      cond_broadcast (&ctx->progress, &rings_lock);
+    }
+}
+
+/** Runs up to URING_BATCH of CTX's submissions, posting a
+   completion for each.  Returns true if more submissions may be
+   waiting, false if the submission ring is empty or the
+   completion ring is full. */
+static bool
+run_batch (struct uring_ctx *ctx, uint8_t *kbuf) 
+{
+  struct uring *ring = ctx->ring;
+  int i;
+
+  for (i = 0; i < URING_BATCH; i++) 
+    {
+      unsigned sq_tail = ring->sq_tail;
+      struct uring_sqe sqe;
+      struct uring_cqe *cqe;
+      int result;
+
+      unsigned queued = sq_tail - ctx->sq_head;
+
+      barrier ();
+      if (queued == 0 || queued > URING_ENTRIES)
+        return false;           /* Empty, or SQ_TAIL is bogus. */
+      if (ctx->cq_tail - ring->cq_head >= URING_ENTRIES)
+        return false;           /* No room for the completion. */
+
+      sqe = ring->sqes[ctx->sq_head % URING_ENTRIES];
+      ring->sq_head = ++ctx->sq_head;
+      result = run_op (ctx, &sqe, kbuf);
+
+      cqe = &ring->cqes[ctx->cq_tail % URING_ENTRIES];
+      cqe->user_data = sqe.user_data;
+      cqe->result = result;
+      barrier ();
+      ring->cq_tail = ++ctx->cq_tail;
+
+      lock_acquire (&rings_lock);
+      cond_broadcast (&ctx->progress, &rings_lock);
+      lock_release (&rings_lock);
+    }
+  return true;
+}
+
+/** Copies SIZE bytes between kernel buffer KADDR and CTX's user
+   address UADDR: into UADDR if TO_USER is true, out of it
+   otherwise.  Returns false if any of UADDR is not mapped, or if
+   TO_USER is true and any of it is mapped read-only. */
+static bool
+copy_user (struct uring_ctx *ctx, void *kaddr, uint8_t *uaddr,
+           size_t size, bool to_user) 
+{
+  uint8_t *k = kaddr;
+
+  while (size > 0) 
+    {
+      size_t chunk = PGSIZE - pg_ofs (uaddr);
+      uint8_t *page;
+
+      if (!is_user_vaddr (uaddr))
+        return false;
+      page = pagedir_get_page (ctx->pagedir, uaddr);
+      if (page == NULL)
+        return false;
+      if (chunk > size)
+        chunk = size;
+      if (to_user) 
+        {
+          /* The kernel alias is always writable, so check the
+             user's mapping, as a write through it would. */
+          if (!pagedir_is_writable (ctx->pagedir, uaddr))
+            return false;
+          memcpy (page, k, chunk);
+          pagedir_set_dirty (ctx->pagedir, uaddr, true);
+        }
+      else
+        memcpy (k, page, chunk);
+      k += chunk;
+      uaddr += chunk;
+      size -= chunk;
+    }
+  return true;
+}
+
+/** Copies the null-terminated user string USTR of CTX into KSTR,
+   which holds SIZE bytes.  Returns false if USTR is not mapped or
+   does not fit. */
+static bool
+copy_user_str (struct uring_ctx *ctx, char *kstr, const char *ustr,
+               size_t size) 
+{
+  size_t i;
+
+  for (i = 0; i < size; i++) 
+    {
+      if (!copy_user (ctx, &kstr[i], (uint8_t *) ustr + i, 1, false))
+        return false;
+      if (kstr[i] == '\0')
+        return true;
+    }
+  return false;
+}
+
+/** Reads or writes SQE's buffer on CTX's behalf, a page at a time
+   through KBUF.  Returns the number of bytes transferred or -1. */
+static int
+run_transfer (struct uring_ctx *ctx, const struct uring_sqe *sqe,
+              uint8_t *kbuf) 
+{
+  bool write = sqe->op == URING_OP_WRITE;
+  struct file *file = NULL;
+  unsigned total = 0;
+
+  if (!write || sqe->fd != STDOUT_FILENO)
+    {
+      file = fd_lookup (ctx->owner, sqe->fd);
+      if (file == NULL || (write && inode_is_dir (file_get_inode (file))))
+        return -1;
+    }
+
+  while (total < sqe->len) 
+    {
+      unsigned chunk = sqe->len - total < PGSIZE ? sqe->len - total : PGSIZE;
+      uint8_t *uaddr = (uint8_t *) sqe->buf + total;
+      off_t result = chunk;
+
+      if (write && !copy_user (ctx, kbuf, uaddr, chunk, false))
+        return -1;
+      if (file == NULL)
+        putbuf ((const char *) kbuf, chunk);
+      else
+        {
+          lock_acquire (&file_lock);
+          result = write ? file_write (file, kbuf, chunk)
+                         : file_read (file, kbuf, chunk);
+          lock_release (&file_lock);
+        }
+      if (!write && !copy_user (ctx, kbuf, uaddr, result, true))
+        return -1;
+      total += result;
+      if ((unsigned) result < chunk)
+        break;
+    }
+  return total;
+}
+
+/** Runs SQE on CTX's behalf, using the page KBUF as a bounce
+   buffer, and returns its result. */
+static int
+run_op (struct uring_ctx *ctx, const struct uring_sqe *sqe, uint8_t *kbuf) 
+{
+  struct file *file;
+  int result = -1;
+
+  lock_acquire (&ctx->fd_lock);
+  switch (sqe->op) 
+    {
+    case URING_OP_OPEN:
+      if (!copy_user_str (ctx, (char *) kbuf, sqe->buf, PGSIZE))
+        break;
+      /* Relative to the owner's working directory, which FD_LOCK
+         keeps it from changing meanwhile. */
+      file = filesys_open_at (ctx->owner->cwd, (const char *) kbuf);
+      if (file == NULL)
+        break;
+      result = fd_alloc (ctx->owner, file);
+      if (result == -1) 
+        {
+          lock_acquire (&file_lock);
+          file_close (file);
+          lock_release (&file_lock);
+        }
+      break;
+
+    case URING_OP_CLOSE:
+      file = fd_lookup (ctx->owner, sqe->fd);
+      if (file == NULL)
+        break;
+      lock_acquire (&file_lock);
+      file_close (file);
+      lock_release (&file_lock);
+      fd_free (ctx->owner, sqe->fd);
+      result = 0;
+      break;
+
+    case URING_OP_READ:
+    case URING_OP_WRITE:
+      result = run_transfer (ctx, sqe, kbuf);
+      break;
+    }
+  lock_release (&ctx->fd_lock);
+
+  return result;
+}
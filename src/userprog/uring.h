@@ -0,0 +1,15 @@
+#ifndef USERPROG_URING_H
+#define USERPROG_URING_H
+
+#include <uring.h>
+
+struct uring_ctx;
+
+void uring_init (void);
+int uring_setup (struct uring *);
+int uring_enter (unsigned min_complete);
+void uring_lock_fds (void);
+void uring_unlock_fds (void);
+void uring_exit (void);
+
+#endif /**< userprog/uring.h */